@@ -19,6 +19,12 @@ public:
           writerIndex_(kCheapPrepend) {
     }
 
+    void swap(Buffer& rhs) {
+        buffer_.swap(rhs.buffer_);
+        std::swap(readerIndex_, rhs.readerIndex_);
+        std::swap(writerIndex_, rhs.writerIndex_);
+    }
+
     size_t readableBytes() const { return writerIndex_ - readerIndex_; }
     size_t writableBytes() const { return buffer_.size() - writerIndex_; }
     size_t prependableBytes() const { return readerIndex_; }
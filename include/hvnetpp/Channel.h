@@ -2,6 +2,7 @@
 
 #include <functional>
 #include <memory>
+#include "hvnetpp/LivenessGuard.h"
 
 namespace hvnetpp {
 
@@ -17,6 +18,8 @@ public:
 
     void handleEvent();
     void tie(const std::shared_ptr<void>& obj);
+    // Cheaper tie for owners confined to this channel's loop thread.
+    void tie(const LivenessGuard& guard);
     void setReadCallback(ReadEventCallback cb) { readCallback_ = std::move(cb); }
     void setWriteCallback(EventCallback cb) { writeCallback_ = std::move(cb); }
     void setCloseCallback(EventCallback cb) { closeCallback_ = std::move(cb); }
@@ -41,6 +44,8 @@ public:
 
     EventLoop* ownerLoop() { return loop_; }
     void remove();
+    // Rebinds a removed channel to another loop, see TcpConnection::migrateTo().
+    void setOwnerLoop(EventLoop* loop);
 
 private:
     void handleEventWithGuard();
@@ -60,6 +65,8 @@ private:
     bool addedToLoop_;
     bool tied_;
     std::weak_ptr<void> tie_;
+    bool livenessTied_;
+    LivenessGuard::Watcher liveness_;
 
     ReadEventCallback readCallback_;
     EventCallback writeCallback_;
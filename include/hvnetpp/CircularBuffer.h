@@ -9,6 +9,9 @@ namespace internal {
 class CircularBuffer {
 public:
     explicit CircularBuffer(unsigned int order);
+    // Mirror-maps 2^order bytes of @c fd starting at @c offset (page aligned),
+    // e.g. a shared memory segment. Does not take ownership of @c fd.
+    CircularBuffer(int fd, size_t offset, unsigned int order);
     ~CircularBuffer();
 
     bool isValid() const { return data_ != nullptr; }
@@ -26,6 +29,7 @@ public:
 
 private:
     void createBufferMirror();
+    void mapMirror(int fd, size_t offset);
 
     size_t size_;
     unsigned char* data_;
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "hvnetpp/TcpConnection.h"
+#include "hvnetpp/LivenessGuard.h"
+#include "hvnetpp/Timer.h"
+#include "hvnetpp/TimerId.h"
+#include <deque>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace hvnetpp {
+
+class Connector;
+class EventLoop;
+
+// Keep-alive connections to backends, owned by one EventLoop.
+// Create one pool per loop; checkout/checkin must happen in that loop's
+// thread, so a borrowed connection never crosses threads.
+class ConnectionPool {
+public:
+    // Called with nullptr if the backend is unavailable.
+    using CheckoutCallback = std::function<void(const TcpConnectionPtr&)>;
+
+    ConnectionPool(EventLoop* loop, const std::string& name);
+    ~ConnectionPool();
+
+    // Connections per backend, idle + borrowed + connecting. Default 64.
+    void setMaxPerHost(size_t n) { maxPerHost_ = n; }
+    // Idle connections older than this are closed. Default 60s.
+    void setIdleTimeout(double seconds) { idleTimeout_ = seconds; }
+    // After @c failures consecutive connect failures the backend is marked
+    // down and checkouts fail fast for @c cooldownSeconds. Default 3, 5s.
+    void setHealthThreshold(int failures, double cooldownSeconds);
+
+    // Hands over an idle connection right away, or connects a new one, or
+    // queues the request until a connection is checked in.
+    void checkout(const InetAddress& backend, const CheckoutCallback& cb);
+    // Returns a borrowed connection. Disconnected ones are dropped.
+    void checkin(const TcpConnectionPtr& conn);
+
+    size_t idleCount(const InetAddress& backend) const;
+    size_t totalCount(const InetAddress& backend) const;
+
+private:
+    struct HostKey {
+        sa_family_t family;
+        uint16_t port;
+        unsigned char addr[16];
+        std::string path; // AF_UNIX only
+
+        explicit HostKey(const InetAddress& a);
+        bool operator==(const HostKey& rhs) const;
+    };
+    struct HostKeyHash {
+        size_t operator()(const HostKey& key) const;
+    };
+    struct IdleEntry {
+        TcpConnectionPtr conn;
+        Timestamp since;
+    };
+    struct Host {
+        explicit Host(const InetAddress& a);
+
+        InetAddress addr;
+        std::vector<IdleEntry> idle; // LIFO, oldest first
+        size_t total;
+        std::deque<CheckoutCallback> waiters;
+        int failures;
+        int retryDelayMs; // backoff before the next reconnect, doubled per failure
+        Timestamp downUntil;
+    };
+    using HostMap = std::unordered_map<HostKey, Host, HostKeyHash>;
+    struct Member {
+        TcpConnectionPtr conn;
+        HostKey backend; // as passed to checkout(), not the peer address
+    };
+
+    Host& hostFor(const InetAddress& backend);
+    Member* memberOf(const TcpConnectionPtr& conn);
+    void startConnect(Host& host);
+    void retireConnector(Connector* connector);
+    void newConnection(const InetAddress& backend, int sockfd);
+    void connectFailed(const InetAddress& backend);
+    void retryConnect(const InetAddress& backend);
+    void removeConnection(const TcpConnectionPtr& conn);
+    void release(Host& host, const TcpConnectionPtr& conn);
+    void evictIdle();
+
+    EventLoop* loop_;
+    const std::string name_;
+    const std::shared_ptr<const std::string> connNamePrefix_;
+    size_t maxPerHost_;
+    double idleTimeout_;
+    int failureThreshold_;
+    double cooldown_;
+    uint64_t nextConnId_;
+    HostMap hosts_;
+    std::unordered_map<uint64_t, Member> connections_; // idle and borrowed
+    std::vector<std::shared_ptr<Connector>> connectors_;
+    TimerId evictTimer_;
+    LivenessGuard liveness_;
+};
+
+} // namespace hvnetpp
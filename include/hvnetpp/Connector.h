@@ -0,0 +1,67 @@
+#pragma once
+
+#include "hvnetpp/InetAddress.h"
+#include "hvnetpp/LivenessGuard.h"
+#include "hvnetpp/TimerId.h"
+#include <atomic>
+#include <functional>
+#include <memory>
+
+namespace hvnetpp {
+
+class Channel;
+class EventLoop;
+
+// Non-blocking connect with exponential backoff on failure.
+// Hands the connected socket to NewConnectionCallback; owned by TcpClient.
+class Connector : public std::enable_shared_from_this<Connector> {
+public:
+    using NewConnectionCallback = std::function<void(int sockfd)>;
+    using ConnectFailedCallback = std::function<void()>;
+
+    Connector(EventLoop* loop, const InetAddress& serverAddr);
+    ~Connector();
+
+    void setNewConnectionCallback(const NewConnectionCallback& cb) { newConnectionCallback_ = cb; }
+    // With retry disabled a failed attempt is reported here instead of retried.
+    void setConnectFailedCallback(const ConnectFailedCallback& cb) { connectFailedCallback_ = cb; }
+    void setRetry(bool on) { retry_ = on; }
+
+    void start();   // can be called in any thread
+    void restart(); // must be called in loop thread
+    void stop();    // can be called in any thread
+
+    const InetAddress& serverAddress() const { return serverAddr_; }
+
+private:
+    enum States { kDisconnected, kConnecting, kConnected };
+    static const int kMaxRetryDelayMs = 30 * 1000;
+    static const int kInitRetryDelayMs = 500;
+
+    void setState(States s) { state_ = s; }
+    void startInLoop();
+    void stopInLoop();
+    void connect();
+    void connecting(int sockfd);
+    void handleWrite();
+    void handleError();
+    void retry(int sockfd);
+    void fail(int sockfd);
+    int removeAndResetChannel();
+
+    EventLoop* loop_;
+    InetAddress serverAddr_;
+    std::atomic<bool> connect_;
+    States state_;
+    std::shared_ptr<Channel> channel_;
+    NewConnectionCallback newConnectionCallback_;
+    ConnectFailedCallback connectFailedCallback_;
+    bool retry_;
+    int retryDelayMs_;
+    TimerId retryTimer_;
+    LivenessGuard liveness_;
+};
+
+using ConnectorPtr = std::shared_ptr<Connector>;
+
+} // namespace hvnetpp
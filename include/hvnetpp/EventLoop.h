@@ -46,6 +46,11 @@ public:
     TimerId runEvery(double interval, TimerCallback cb);
     void cancel(TimerId timerId);
 
+    // Time spent handling events and pending functors since construction,
+    // i.e. not blocked in the poller. Thread safe; sample it twice to get the
+    // load over an interval.
+    int64_t busyMicroseconds() const { return busyMicroseconds_.load(std::memory_order_relaxed); }
+
 private:
     void wakeup();
     void handleRead(); // for wake up
@@ -75,6 +80,7 @@ private:
     };
     using PendingQueue = MpscQueue<FunctorTask>;
     std::unique_ptr<PendingQueue> pendingQueue_;
+    std::atomic<int64_t> busyMicroseconds_;
 };
 
 } // namespace hvnetpp
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace hvnetpp {
+
+class EventLoop;
+
+// Runs an EventLoop in a thread of its own.
+class EventLoopThread {
+public:
+    using ThreadInitCallback = std::function<void(EventLoop*)>;
+
+    explicit EventLoopThread(const ThreadInitCallback& cb = ThreadInitCallback(),
+                             const std::string& name = std::string());
+    ~EventLoopThread(); // quits the loop and joins
+
+    // Starts the thread and returns its loop once it is running.
+    EventLoop* startLoop();
+
+private:
+    void threadFunc();
+
+    EventLoop* loop_;
+    std::thread thread_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    ThreadInitCallback callback_;
+    const std::string name_;
+};
+
+} // namespace hvnetpp
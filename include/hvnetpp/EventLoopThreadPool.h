@@ -0,0 +1,41 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace hvnetpp {
+
+class EventLoop;
+class EventLoopThread;
+
+// A fixed set of loop threads. With zero threads the base loop does all the work.
+class EventLoopThreadPool {
+public:
+    using ThreadInitCallback = std::function<void(EventLoop*)>;
+
+    EventLoopThreadPool(EventLoop* baseLoop, const std::string& name);
+    ~EventLoopThreadPool();
+
+    void setThreadNum(int numThreads) { numThreads_ = numThreads; }
+    void start(const ThreadInitCallback& cb = ThreadInitCallback());
+
+    // Round robin. Call in the base loop thread after start().
+    EventLoop* getNextLoop();
+    std::vector<EventLoop*> getAllLoops();
+
+    bool started() const { return started_; }
+    const std::string& name() const { return name_; }
+
+private:
+    EventLoop* baseLoop_;
+    const std::string name_;
+    bool started_;
+    int numThreads_;
+    size_t next_;
+    std::vector<std::unique_ptr<EventLoopThread>> threads_;
+    std::vector<EventLoop*> loops_;
+};
+
+} // namespace hvnetpp
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+namespace hvnetpp {
+
+// Open-addressing hash map with linear probing over one flat array and
+// backward-shift deletion, so lookups touch adjacent memory and erase
+// leaves no tombstones. Keys and values must be default constructible.
+// Nothing is allocated unless the table grows.
+template <typename Key, typename Value, typename Hash = std::hash<Key>>
+class FlatHashMap {
+public:
+    explicit FlatHashMap(size_t initialCapacity = 8) : size_(0) {
+        size_t capacity = 8;
+        while (capacity < initialCapacity) {
+            capacity <<= 1;
+        }
+        slots_.resize(capacity);
+    }
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    Value* find(const Key& key) {
+        const size_t mask = slots_.size() - 1;
+        for (size_t i = indexOf(key);; i = (i + 1) & mask) {
+            Slot& slot = slots_[i];
+            if (!slot.used) {
+                return nullptr;
+            }
+            if (slot.key == key) {
+                return &slot.value;
+            }
+        }
+    }
+
+    // Inserts or overwrites.
+    Value& insert(const Key& key, Value value) {
+        if ((size_ + 1) * 4 > slots_.size() * 3) {
+            rehash(slots_.size() * 2);
+        }
+        const size_t mask = slots_.size() - 1;
+        size_t i = indexOf(key);
+        while (slots_[i].used && !(slots_[i].key == key)) {
+            i = (i + 1) & mask;
+        }
+        Slot& slot = slots_[i];
+        if (!slot.used) {
+            slot.used = true;
+            slot.key = key;
+            ++size_;
+        }
+        slot.value = std::move(value);
+        return slot.value;
+    }
+
+    bool erase(const Key& key) {
+        const size_t mask = slots_.size() - 1;
+        for (size_t i = indexOf(key);; i = (i + 1) & mask) {
+            if (!slots_[i].used) {
+                return false;
+            }
+            if (slots_[i].key == key) {
+                eraseAt(i);
+                return true;
+            }
+        }
+    }
+
+    // Erases every entry for which @c pred(key, value) is true.
+    template <typename Pred>
+    size_t eraseIf(Pred pred) {
+        size_t erased = 0;
+        for (size_t i = 0; i < slots_.size();) {
+            // eraseAt() shifts a later entry into i, so look at i again.
+            if (slots_[i].used && pred(slots_[i].key, slots_[i].value)) {
+                eraseAt(i);
+                ++erased;
+            } else {
+                ++i;
+            }
+        }
+        return erased;
+    }
+
+    template <typename Func>
+    void forEach(Func func) {
+        for (Slot& slot : slots_) {
+            if (slot.used) {
+                func(slot.key, slot.value);
+            }
+        }
+    }
+
+    void clear() {
+        for (Slot& slot : slots_) {
+            if (slot.used) {
+                slot = Slot();
+            }
+        }
+        size_ = 0;
+    }
+
+private:
+    struct Slot {
+        Slot() : used(false), key(), value() {}
+        bool used;
+        Key key;
+        Value value;
+    };
+
+    size_t indexOf(const Key& key) const {
+        // Fibonacci hashing spreads identity hashes of small integers.
+        const uint64_t h = static_cast<uint64_t>(Hash()(key)) * 0x9E3779B97F4A7C15ULL;
+        return static_cast<size_t>(h >> 32) & (slots_.size() - 1);
+    }
+
+    void eraseAt(size_t hole) {
+        const size_t mask = slots_.size() - 1;
+        size_t i = hole;
+        while (true) {
+            i = (i + 1) & mask;
+            if (!slots_[i].used) {
+                break;
+            }
+            // Move the entry back unless its home lies cyclically in (hole, i].
+            const size_t home = indexOf(slots_[i].key);
+            const bool stays = hole <= i ? (hole < home && home <= i) : (hole < home || home <= i);
+            if (!stays) {
+                slots_[hole] = std::move(slots_[i]);
+                hole = i;
+            }
+        }
+        slots_[hole] = Slot();
+        --size_;
+    }
+
+    void rehash(size_t capacity) {
+        std::vector<Slot> old(capacity);
+        old.swap(slots_);
+        size_ = 0;
+        for (Slot& slot : old) {
+            if (slot.used) {
+                insert(slot.key, std::move(slot.value));
+            }
+        }
+    }
+
+    std::vector<Slot> slots_;
+    size_t size_;
+};
+
+} // namespace hvnetpp
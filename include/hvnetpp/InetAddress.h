@@ -1,11 +1,14 @@
 #pragma once
 
+#include <cstring>
 #include <string>
 #include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 namespace hvnetpp {
 
-// Wrapper of sockaddr_in.
+// Wrapper of sockaddr_in, sockaddr_in6 and sockaddr_un.
 // This is an POD interface class.
 class InetAddress {
 public:
@@ -25,12 +28,41 @@ public:
     explicit InetAddress(const struct sockaddr_in6& addr)
         : addr6_(addr) {}
 
+    // Any of the above, e.g. from getsockname()/accept()/recvfrom().
+    // Inline and copies only the bytes the family uses, it sits on the
+    // per-datagram UDP path.
+    explicit InetAddress(const struct sockaddr_storage& addr) {
+        if (addr.ss_family == AF_UNIX) {
+            memcpy(&addrUn_, &addr, sizeof addrUn_);
+        } else {
+            memcpy(&addr6_, &addr, sizeof addr6_);
+        }
+    }
+
+    // Same for copies: IP addresses move 28 bytes, not the whole sockaddr_un.
+    InetAddress(const InetAddress& other) { copyFrom(other); }
+    InetAddress& operator=(const InetAddress& other) {
+        if (this != &other) {
+            copyFrom(other);
+        }
+        return *this;
+    }
+
+    // Constructs an AF_UNIX stream endpoint. With @c abstractNamespace the
+    // name lives in the Linux abstract namespace, not on the filesystem.
+    // A path that doesn't fit gives an invalid address (valid() false).
+    static InetAddress fromUnixPath(const std::string& path, bool abstractNamespace = false);
+
     sa_family_t family() const { return addr_.sin_family; }
+    bool valid() const { return family() != AF_UNSPEC; }
+    bool isUnix() const { return family() == AF_UNIX; }
+    // For AF_UNIX, toIp() and toIpPort() give the path, '@'-prefixed if abstract.
     std::string toIp() const;
     std::string toIpPort() const;
     uint16_t toPort() const;
 
     const struct sockaddr* getSockAddr() const { return reinterpret_cast<const struct sockaddr*>(&addr6_); }
+    socklen_t getSockAddrLen() const;
     void setSockAddr6(const struct sockaddr_in6& addr6) { addr6_ = addr6; }
 
     uint32_t ipNetEndian() const;
@@ -42,9 +74,18 @@ public:
     static bool resolve(std::string hostname, InetAddress* result);
 
 private:
+    void copyFrom(const InetAddress& other) {
+        if (other.isUnix()) {
+            memcpy(&addrUn_, &other.addrUn_, sizeof addrUn_);
+        } else {
+            memcpy(&addr6_, &other.addr6_, sizeof addr6_);
+        }
+    }
+
     union {
         struct sockaddr_in addr_;
         struct sockaddr_in6 addr6_;
+        struct sockaddr_un addrUn_;
     };
 };
 
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+#include <stdint.h>
+#include <vector>
+
+namespace hvnetpp {
+
+class RtpPacket;
+
+// Reorders one RTP stream in a fixed ring of preallocated slots indexed by
+// sequence number mod capacity, so insert() and next() never allocate.
+// A gap is waited on until the packet after it has been held for
+// @c maxDelayUs, then counted as lost and skipped.
+class JitterBuffer {
+public:
+    enum InsertResult {
+        kInserted,
+        kDuplicate,
+        kTooLate,  // already released or skipped
+        kTooLarge, // larger than maxPacketSize
+    };
+
+    struct Entry {
+        const char* data; // valid until the next insert()
+        size_t len;
+        uint16_t seq;
+        int64_t arrivalUs;
+    };
+
+    // @c capacity is rounded up to a power of two.
+    JitterBuffer(size_t capacity, size_t maxPacketSize, int64_t maxDelayUs);
+
+    // Packets more than capacity ahead of the release point push it
+    // forward, dropping whatever was still held.
+    InsertResult insert(const RtpPacket& packet, int64_t arrivalUs);
+    // Returns false when nothing is due at @c nowUs.
+    bool next(int64_t nowUs, Entry* entry);
+    void reset();
+
+    size_t capacity() const { return slots_.size(); }
+    size_t size() const { return size_; }
+    uint64_t lost() const { return lost_; }
+    uint64_t dropped() const { return dropped_; }
+    uint64_t late() const { return late_; }
+    uint64_t duplicates() const { return duplicates_; }
+
+private:
+    struct Slot {
+        bool used;
+        uint16_t seq;
+        size_t len;
+        int64_t arrivalUs;
+    };
+
+    void release(Slot& slot, Entry* entry);
+    void advanceTo(uint16_t seq);
+
+    const size_t maxPacketSize_;
+    const int64_t maxDelayUs_;
+    size_t mask_;
+    std::vector<Slot> slots_;
+    std::vector<char> storage_;
+    bool started_;
+    uint16_t nextSeq_;
+    size_t size_;
+    uint64_t lost_;
+    uint64_t dropped_;
+    uint64_t late_;
+    uint64_t duplicates_;
+};
+
+} // namespace hvnetpp
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <assert.h>
+
+namespace hvnetpp {
+
+// Non-atomic liveness flag for objects confined to one loop thread.
+// The owner holds the guard; callbacks that may outlive it hold a Watcher
+// and check alive() before touching the owner. Unlike weak_ptr::lock()
+// this is a plain load, so it must only be copied and checked in the loop
+// thread (or before the loop starts).
+class LivenessGuard {
+    struct State {
+        int refs;
+        bool alive;
+    };
+
+public:
+    class Watcher {
+    public:
+        Watcher() : state_(nullptr) {}
+        Watcher(const Watcher& rhs) : state_(rhs.state_) { retain(); }
+        Watcher& operator=(const Watcher& rhs) {
+            if (this != &rhs) {
+                release();
+                state_ = rhs.state_;
+                retain();
+            }
+            return *this;
+        }
+        ~Watcher() { release(); }
+
+        bool alive() const { return state_ && state_->alive; }
+
+    private:
+        friend class LivenessGuard;
+        explicit Watcher(State* state) : state_(state) { retain(); }
+
+        void retain() {
+            if (state_) {
+                ++state_->refs;
+            }
+        }
+        void release() {
+            if (state_ && --state_->refs == 0) {
+                delete state_;
+            }
+            state_ = nullptr;
+        }
+
+        State* state_;
+    };
+
+    LivenessGuard() : state_(new State{1, true}) {}
+    ~LivenessGuard() {
+        state_->alive = false;
+        if (--state_->refs == 0) {
+            delete state_;
+        }
+    }
+
+    LivenessGuard(const LivenessGuard&) = delete;
+    LivenessGuard& operator=(const LivenessGuard&) = delete;
+
+    Watcher watch() const { return Watcher(state_); }
+
+private:
+    State* state_;
+};
+
+} // namespace hvnetpp
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "hvnetpp/TcpConnection.h"
+#include "hvnetpp/TimerId.h"
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+namespace hvnetpp {
+
+class EventLoop;
+
+// Moves hot connections off overloaded loops. Every interval it samples
+// EventLoop::busyMicroseconds() of each loop; if the busiest loop's load
+// exceeds the idlest one's by more than the threshold, the tracked
+// connection with the most traffic on the busiest loop migrates to the
+// idlest. Register connections with track(), e.g. in the connection callback.
+class LoopBalancer {
+public:
+    // Runs on @c loop and balances across @c loops. Destroy, start and stop
+    // it in that loop's thread.
+    LoopBalancer(EventLoop* loop, const std::vector<EventLoop*>& loops);
+    ~LoopBalancer();
+
+    void setInterval(double seconds) { interval_ = seconds; }
+    // Load gap as a fraction of the interval, 0.25 by default.
+    void setThreshold(double gap) { threshold_ = gap; }
+
+    void start();
+    void stop();
+
+    // Thread safe. Takes the loop the connection is on now; connections on
+    // loops outside the set are ignored.
+    void track(const TcpConnectionPtr& conn);
+
+private:
+    struct Entry {
+        std::weak_ptr<TcpConnection> conn;
+        uint64_t lastBytes;
+    };
+    // Touched only in the thread of its loop.
+    struct Shard {
+        EventLoop* loop;
+        std::vector<Entry> entries;
+    };
+    using ShardList = std::vector<std::shared_ptr<Shard>>;
+
+    void balance();
+    static void addInLoop(const std::shared_ptr<Shard>& shard, const Entry& entry);
+    static void moveHottest(const std::shared_ptr<ShardList>& shards, size_t from, size_t to);
+
+    EventLoop* loop_;
+    const std::shared_ptr<ShardList> shards_;
+    std::vector<int64_t> lastBusy_;
+    double interval_;
+    double threshold_;
+    bool started_;
+    TimerId timer_;
+};
+
+} // namespace hvnetpp
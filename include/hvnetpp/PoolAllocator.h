@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <vector>
+
+namespace hvnetpp {
+namespace internal {
+
+// Thread-local free list of fixed-size blocks. Every loop runs in its own
+// thread, so each loop recycles the objects it frees without locking.
+template <size_t BlockSize>
+class BlockCache {
+public:
+    static const size_t kMaxCached = 4096;
+
+    static void* allocate() {
+        Cache* c = cache();
+        if (c && !c->blocks.empty()) {
+            void* p = c->blocks.back();
+            c->blocks.pop_back();
+            return p;
+        }
+        return ::operator new(BlockSize);
+    }
+
+    static void deallocate(void* p) {
+        Cache* c = cache();
+        if (c && c->blocks.size() < kMaxCached) {
+            c->blocks.push_back(p);
+        } else {
+            ::operator delete(p);
+        }
+    }
+
+private:
+    struct Cache {
+        std::vector<void*> blocks;
+        ~Cache() {
+            for (void* p : blocks) {
+                ::operator delete(p);
+            }
+            destroyed() = true;
+        }
+    };
+
+    // Trivially destructible, so it stays readable after Cache is gone.
+    static bool& destroyed() {
+        static thread_local bool d = false;
+        return d;
+    }
+
+    // nullptr once the thread's cache is destroyed, e.g. when another
+    // thread_local frees a pooled object at thread exit.
+    static Cache* cache() {
+        if (destroyed()) {
+            return nullptr;
+        }
+        static thread_local Cache c;
+        return &c;
+    }
+};
+
+// Allocator for std::allocate_shared, so the object and its control block
+// share one recycled block.
+template <typename T>
+class PoolAllocator {
+public:
+    using value_type = T;
+
+    PoolAllocator() {}
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U>&) {}
+
+    T* allocate(size_t n) {
+        if (n == 1) {
+            return static_cast<T*>(BlockCache<sizeof(T)>::allocate());
+        }
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, size_t n) {
+        if (n == 1) {
+            BlockCache<sizeof(T)>::deallocate(p);
+        } else {
+            ::operator delete(p);
+        }
+    }
+};
+
+template <typename T, typename U>
+bool operator==(const PoolAllocator<T>&, const PoolAllocator<U>&) { return true; }
+template <typename T, typename U>
+bool operator!=(const PoolAllocator<T>&, const PoolAllocator<U>&) { return false; }
+
+} // namespace internal
+} // namespace hvnetpp
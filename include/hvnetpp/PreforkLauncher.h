@@ -0,0 +1,99 @@
+#pragma once
+
+#include "hvnetpp/InetAddress.h"
+#include <sys/types.h>
+#include <atomic>
+#include <functional>
+#include <stdint.h>
+#include <vector>
+
+namespace hvnetpp {
+
+class EventLoop;
+
+// Multi-process mode: N forked workers, each with its own EventLoop and
+// TcpServer, share the port through SO_REUSEPORT. The parent holds a bound
+// socket so the port stays reserved across respawns, restarts workers that
+// exit and sums the stats they report over a pipe. Call run() before
+// creating any EventLoop in the parent.
+class PreforkLauncher {
+public:
+    struct Stats {
+        Stats() : connections(0), accepted(0), bytesRead(0), bytesWritten(0) {}
+        uint64_t connections; // currently open
+        uint64_t accepted;    // since the worker started
+        uint64_t bytesRead;
+        uint64_t bytesWritten;
+    };
+    using StatsSampler = std::function<Stats()>;
+
+    // Handed to the worker init callback in the child process.
+    class Worker {
+    public:
+        EventLoop* loop() const { return loop_; }
+        int index() const { return index_; }
+        const InetAddress& listenAddress() const { return listenAddr_; }
+        // Called on the worker loop every stats interval.
+        void setStatsSampler(const StatsSampler& sampler) { sampler_ = sampler; }
+
+    private:
+        friend class PreforkLauncher;
+        Worker(EventLoop* loop, int index, const InetAddress& listenAddr)
+            : loop_(loop), index_(index), listenAddr_(listenAddr) {}
+
+        EventLoop* loop_;
+        int index_;
+        const InetAddress& listenAddr_;
+        StatsSampler sampler_;
+    };
+    // Runs in the child after fork; create the TcpServer on worker->loop()
+    // with worker->listenAddress(), the address the parent actually bound
+    // (so port 0 is resolved). The loop runs once it returns.
+    using WorkerInitCallback = std::function<void(Worker* worker)>;
+    using StatsCallback = std::function<void(const Stats& total)>;
+
+    PreforkLauncher(const InetAddress& listenAddr, int numWorkers);
+    ~PreforkLauncher();
+
+    void setWorkerInitCallback(const WorkerInitCallback& cb) { workerInitCallback_ = cb; }
+    // Called in the parent every stats interval with the sum over workers.
+    void setStatsCallback(const StatsCallback& cb) { statsCallback_ = cb; }
+    void setStatsInterval(double seconds) { statsInterval_ = seconds; }
+
+    // Forks the workers and supervises them until stop(). Workers get
+    // SIGTERM on stop and if the parent dies. Returns 0, or -1 if the
+    // address can't be bound or is not IPv4/IPv6. Only returns in the parent.
+    int run();
+    // Async-signal-safe.
+    void stop() { quit_ = true; }
+
+    Stats totalStats() const;
+
+private:
+    struct WorkerSlot {
+        WorkerSlot() : pid(-1), startedMs(0), respawnAtMs(0) {}
+        pid_t pid;
+        int64_t startedMs;
+        int64_t respawnAtMs;
+        Stats stats;
+    };
+
+    void spawnWorkers(int64_t nowMs);
+    void runWorker(int index);
+    void reapWorkers(int64_t nowMs);
+    void readStats();
+    void stopWorkers();
+
+    const InetAddress listenAddr_;
+    InetAddress boundAddr_; // listenAddr_ with the port the reserve socket got
+    const int numWorkers_;
+    WorkerInitCallback workerInitCallback_;
+    StatsCallback statsCallback_;
+    double statsInterval_;
+    std::atomic<bool> quit_;
+    int reserveFd_;
+    int statsPipe_[2];
+    std::vector<WorkerSlot> workers_;
+};
+
+} // namespace hvnetpp
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "hvnetpp/RtpPacket.h"
+#include "hvnetpp/Timer.h"
+#include "hvnetpp/TimerId.h"
+
+#include <sys/types.h>
+#include <vector>
+
+namespace hvnetpp {
+
+class EventLoop;
+class InetAddress;
+class UdpSocket;
+
+// Keeps the RTP packets one stream sent during the last @c windowMs to
+// answer NACKs. Packets are copied into a preallocated byte slab used as a
+// ring and indexed by sequence number mod @c slots, so store() and
+// lookup() are O(1) and never allocate. The oldest packets are evicted
+// when their space is needed and by a periodic expiry timer. Loop thread
+// only.
+class RetransmissionCache {
+public:
+    struct Config {
+        Config() : bitrateBps(2000000), windowMs(3000), slots(2048), maxPacketSize(1500) {}
+        uint64_t bitrateBps; // slab size is bitrate x window
+        uint32_t windowMs;
+        size_t slots;        // rounded up to a power of two, at most 32768
+        size_t maxPacketSize;
+    };
+    struct Stats {
+        uint64_t stored;
+        uint64_t hits;
+        uint64_t misses;
+    };
+
+    RetransmissionCache(EventLoop* loop, const Config& config = Config());
+    ~RetransmissionCache();
+
+    // Call with every RTP packet as it is sent.
+    void store(const char* data, size_t len);
+    // @c data stays valid until the next store().
+    bool lookup(uint16_t seq, const char** data, size_t* len);
+
+    // Looks up @c seq and sends it again. Returns -1 on a miss.
+    ssize_t resend(uint16_t seq, UdpSocket* socket, const InetAddress& dest);
+    // Answers a generic NACK (RFC 4585, RTPFB FMT 1) for this stream's
+    // SSRC, e.g. from RtpReceiver's RTCP callback. Returns packets resent.
+    size_t onNack(const RtcpReader::Block& block, UdpSocket* socket, const InetAddress& dest);
+
+    size_t slabSize() const { return slab_.size(); }
+    size_t size() const { return fifoSize_; }
+    const Stats& stats() const { return stats_; }
+
+private:
+    struct Slot {
+        bool valid;
+        uint16_t seq;
+        uint32_t offset;
+        uint32_t len;
+        Timestamp sent;
+    };
+    struct Record { // allocation order, may refer to already invalid slots
+        uint16_t seq;
+        uint32_t offset;
+        uint32_t len;
+    };
+
+    void popOldest();
+    void expire();
+
+    EventLoop* loop_;
+    const std::chrono::milliseconds window_;
+    const size_t maxPacketSize_;
+    size_t mask_;
+    std::vector<char> slab_;
+    std::vector<Slot> slots_;
+    std::vector<Record> fifo_;
+    size_t fifoHead_;
+    size_t fifoSize_;
+    size_t writePos_;
+    bool haveSsrc_;
+    uint32_t ssrc_;
+    Stats stats_;
+    TimerId expireTimer_;
+};
+
+} // namespace hvnetpp
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "hvnetpp/InetAddress.h"
+
+#include <atomic>
+#include <memory>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <unordered_map>
+#include <vector>
+
+namespace hvnetpp {
+
+class EventLoop;
+class UdpServer;
+class UdpSocket;
+
+// SFU fan-out: forwards one RTP stream to many subscribers, rewriting
+// SSRC, sequence number and timestamp per subscriber. Only the 12-byte
+// fixed header is patched, in a per-subscriber scratch slot; the rest of
+// the datagram is shared by all copies through a second iovec, and the
+// copies leave in batches of sendmmsg(). Subscribers are spread over
+// shards, one per loop, each sending through its own socket.
+class RtpForwarder {
+public:
+    struct Shard;
+    struct Stats {
+        uint64_t forwarded;
+        uint64_t dropped; // socket buffer or hand-over ring full, or send error
+    };
+    // Each subscriber's stream starts at @c firstSeq / @c firstTimestamp
+    // and then follows the source's deltas.
+    struct Rewrite {
+        Rewrite(uint32_t ssrc = 0, uint16_t firstSeq = 0, uint32_t firstTimestamp = 0)
+            : ssrc(ssrc), firstSeq(firstSeq), firstTimestamp(firstTimestamp) {}
+        uint32_t ssrc;
+        uint16_t firstSeq;
+        uint32_t firstTimestamp;
+    };
+
+    // Sockets and loops must outlive the forwarder.
+    explicit RtpForwarder(UdpSocket* socket, EventLoop* loop);
+    // One shard per socket of a started UdpServer.
+    explicit RtpForwarder(UdpServer* server);
+    ~RtpForwarder();
+
+    // Thread safe. The subscriber goes to the shard with the fewest.
+    uint64_t addSubscriber(const InetAddress& dest, const Rewrite& rewrite);
+    void removeSubscriber(uint64_t id);
+    size_t subscriberCount() const;
+
+    // Call from one thread at a time, usually the source's loop. Shards
+    // whose loop is the calling thread send right away from @c data; the
+    // others get a copy in their hand-over ring (packets up to 1500 bytes,
+    // 256 deep, dropped when full) and one wakeup per batch.
+    // Returns false if @c data is not RTP.
+    bool forward(const char* data, size_t len);
+
+    Stats stats() const;
+
+private:
+    void addShard(UdpSocket* socket, EventLoop* loop);
+
+    std::vector<std::shared_ptr<Shard>> shards_;
+    std::atomic<uint64_t> nextId_;
+};
+
+} // namespace hvnetpp
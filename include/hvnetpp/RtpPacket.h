@@ -0,0 +1,131 @@
+#pragma once
+
+#include <cstddef>
+#include <stdint.h>
+
+namespace hvnetpp {
+
+namespace rtp {
+
+inline uint16_t readBe16(const uint8_t* p) {
+    return static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+inline uint32_t readBe32(const uint8_t* p) {
+    return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16)
+        | (static_cast<uint32_t>(p[2]) << 8) | p[3];
+}
+inline void writeBe16(uint8_t* p, uint16_t v) {
+    p[0] = static_cast<uint8_t>(v >> 8);
+    p[1] = static_cast<uint8_t>(v);
+}
+inline void writeBe32(uint8_t* p, uint32_t v) {
+    p[0] = static_cast<uint8_t>(v >> 24);
+    p[1] = static_cast<uint8_t>(v >> 16);
+    p[2] = static_cast<uint8_t>(v >> 8);
+    p[3] = static_cast<uint8_t>(v);
+}
+
+// RTP and RTCP share a port (RFC 5761); RTCP packet types 192-223 can't be
+// valid RTP payload types with the marker bit.
+inline bool isRtcp(const char* data, size_t len) {
+    if (len < 2) {
+        return false;
+    }
+    const uint8_t pt = static_cast<uint8_t>(data[1]);
+    return pt >= 192 && pt <= 223;
+}
+
+} // namespace rtp
+
+// Zero-copy view of an RTP packet (RFC 3550) over a received datagram.
+// parse() validates the fixed header, CSRCs, extension and padding once;
+// the accessors then read straight from the datagram.
+class RtpPacket {
+public:
+    RtpPacket() : data_(nullptr), size_(0), payloadOffset_(0), payloadSize_(0),
+                  extensionOffset_(0), extensionSize_(0) {}
+
+    bool parse(const char* data, size_t len);
+
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+
+    bool marker() const { return (bytes()[1] & 0x80) != 0; }
+    uint8_t payloadType() const { return bytes()[1] & 0x7f; }
+    uint16_t sequenceNumber() const { return rtp::readBe16(bytes() + 2); }
+    uint32_t timestamp() const { return rtp::readBe32(bytes() + 4); }
+    uint32_t ssrc() const { return rtp::readBe32(bytes() + 8); }
+    int csrcCount() const { return bytes()[0] & 0x0f; }
+    uint32_t csrc(int i) const { return rtp::readBe32(bytes() + 12 + 4 * i); }
+
+    bool hasExtension() const { return extensionOffset_ != 0; }
+    uint16_t extensionProfile() const { return rtp::readBe16(bytes() + extensionOffset_ - 4); }
+    // RFC 8285 one-byte (0xBEDE) and two-byte header extensions.
+    // Returns false if @c id is absent.
+    bool findExtension(uint8_t id, const char** value, size_t* len) const;
+
+    size_t headerSize() const { return payloadOffset_; }
+    const char* payload() const { return data_ + payloadOffset_; }
+    size_t payloadSize() const { return payloadSize_; }
+
+private:
+    const uint8_t* bytes() const { return reinterpret_cast<const uint8_t*>(data_); }
+
+    const char* data_;
+    size_t size_;
+    size_t payloadOffset_;
+    size_t payloadSize_;
+    size_t extensionOffset_; // start of the extension data, 0 if none
+    size_t extensionSize_;
+};
+
+// Iterates the packets of a compound RTCP datagram.
+class RtcpReader {
+public:
+    struct Block {
+        uint8_t type;  // 200 SR, 201 RR, 202 SDES, 203 BYE, 205/206 feedback
+        uint8_t count; // report count or feedback format
+        const char* data; // whole packet including its 4-byte header
+        size_t len;
+    };
+
+    RtcpReader(const char* data, size_t len) : data_(data), len_(len), offset_(0) {}
+    // Returns false at the end or on a malformed packet.
+    bool next(Block* block);
+
+private:
+    const char* data_;
+    size_t len_;
+    size_t offset_;
+};
+
+struct RtcpSenderInfo {
+    uint32_t ssrc;
+    uint64_t ntpTimestamp;
+    uint32_t rtpTimestamp;
+    uint32_t packetCount;
+    uint32_t octetCount;
+};
+
+struct RtcpReportBlock {
+    uint32_t ssrc;
+    uint8_t fractionLost;
+    int32_t cumulativeLost; // 24 bits on the wire
+    uint32_t extendedHighestSeq;
+    uint32_t jitter;
+    uint32_t lastSr;
+    uint32_t delaySinceLastSr;
+};
+
+namespace rtcp {
+
+bool parseSenderInfo(const RtcpReader::Block& block, RtcpSenderInfo* info);
+// Report blocks of an SR or RR; returns how many were stored in @c blocks.
+size_t parseReportBlocks(const RtcpReader::Block& block, RtcpReportBlock* blocks, size_t maxBlocks);
+// Writes an RR with up to 31 blocks, returns its size or 0 if @c capacity is too small.
+size_t writeReceiverReport(uint32_t senderSsrc, const RtcpReportBlock* blocks, size_t count,
+                           char* out, size_t capacity);
+
+} // namespace rtcp
+
+} // namespace hvnetpp
@@ -0,0 +1,109 @@
+#pragma once
+
+#include "hvnetpp/JitterBuffer.h"
+#include "hvnetpp/RtpPacket.h"
+
+#include <functional>
+#include <memory>
+#include <unordered_map>
+
+namespace hvnetpp {
+
+// Per-source reception statistics as in RFC 3550 appendix A: sequence
+// validation (A.1), loss (A.3) and interarrival jitter (A.8).
+class RtpReceiveStats {
+public:
+    explicit RtpReceiveStats(uint32_t clockRate);
+
+    // Returns false while the source is on probation or the packet is a
+    // bad sequence jump; such packets shouldn't be played out.
+    // All times are microseconds on one clock of the caller's choice, e.g.
+    // UdpSocket::receiveTimestampNs() / 1000 (wall clock) or a monotonic
+    // one; only differences are used.
+    bool update(const RtpPacket& packet, int64_t arrivalUs);
+    void onSenderReport(const RtcpSenderInfo& info, int64_t arrivalUs);
+    // Fills one report block and starts the next reporting interval.
+    void fillReportBlock(uint32_t ssrc, int64_t nowUs, RtcpReportBlock* block);
+
+    uint32_t extendedHighestSeq() const { return cycles_ + maxSeq_; }
+    uint64_t received() const { return received_; }
+    int64_t cumulativeLost() const;
+    // Interarrival jitter in RTP timestamp units.
+    uint32_t jitter() const { return jitter_ >> 4; }
+
+private:
+    void initSequence(uint16_t seq);
+
+    const uint32_t clockRate_;
+    uint16_t maxSeq_;
+    uint32_t cycles_;
+    uint32_t baseSeq_;
+    uint32_t badSeq_;
+    uint32_t probation_;
+    uint64_t received_;
+    uint64_t expectedPrior_;
+    uint64_t receivedPrior_;
+    bool haveTransit_;
+    uint32_t transit_;
+    uint32_t jitter_; // scaled by 16
+    uint32_t lastSr_;
+    int64_t lastSrArrivalUs_;
+};
+
+// Demultiplexes RTP and RTCP arriving on one socket into per-SSRC stats
+// and jitter buffers. Streams are created on first sight; after that the
+// packet path doesn't allocate. Feed it from UdpSocket::setPacketCallback.
+class RtpReceiver {
+public:
+    struct Config {
+        Config() : clockRate(90000), bufferCapacity(512), maxPacketSize(1500),
+                   maxDelayUs(50000), maxStreams(64) {}
+        uint32_t clockRate;
+        size_t bufferCapacity;
+        size_t maxPacketSize;
+        int64_t maxDelayUs;
+        size_t maxStreams;
+    };
+
+    struct Stream {
+        Stream(const Config& config)
+            : stats(config.clockRate),
+              buffer(config.bufferCapacity, config.maxPacketSize, config.maxDelayUs) {}
+        RtpReceiveStats stats;
+        JitterBuffer buffer;
+    };
+
+    using RtcpCallback = std::function<void(const RtcpReader::Block& block, int64_t arrivalUs)>;
+
+    explicit RtpReceiver(const Config& config = Config());
+
+    // Returns false for datagrams that are neither valid RTP nor RTCP.
+    // @c arrivalUs and the @c nowUs of reports share one clock, see
+    // RtpReceiveStats::update().
+    bool onDatagram(const char* data, size_t len, int64_t arrivalUs);
+    // Called for RTCP packets other than sender reports (feedback, BYE, ...).
+    void setRtcpCallback(RtcpCallback cb) { rtcpCallback_ = std::move(cb); }
+
+    // nullptr for unknown sources.
+    Stream* stream(uint32_t ssrc);
+    template <typename Func>
+    void forEachStream(Func func) {
+        for (auto& it : streams_) {
+            func(it.first, *it.second);
+        }
+    }
+
+    // Receiver report covering up to 31 sources; returns its size, 0 if
+    // @c capacity is too small.
+    size_t buildReceiverReport(uint32_t localSsrc, int64_t nowUs, char* out, size_t capacity);
+
+private:
+    void onRtp(const char* data, size_t len, int64_t arrivalUs);
+    void onRtcp(const char* data, size_t len, int64_t arrivalUs);
+
+    const Config config_;
+    std::unordered_map<uint32_t, std::unique_ptr<Stream>> streams_;
+    RtcpCallback rtcpCallback_;
+};
+
+} // namespace hvnetpp
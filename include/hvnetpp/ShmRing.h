@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace hvnetpp {
+
+class Channel;
+class EventLoop;
+
+namespace internal {
+class CircularBuffer;
+}
+
+// Single-producer single-consumer byte stream between two processes.
+// A memfd segment holds a header page plus a mirror-mapped data ring, so the
+// readable region is always contiguous. An eventfd doorbell wakes the reader
+// through its EventLoop. The creator hands both fds to the peer over an
+// AF_UNIX socket; use two rings for a duplex link.
+class ShmRing {
+public:
+    using ReadCallback = std::function<void(ShmRing*)>;
+
+    // Ring of 2^order bytes, order clamped to [12, 30]. Returns nullptr on failure.
+    static std::unique_ptr<ShmRing> create(EventLoop* loop, const std::string& name, unsigned int order);
+    // Attaches to a segment sent by sendFds(). Takes ownership of both fds.
+    static std::unique_ptr<ShmRing> attach(EventLoop* loop, int memfd, int eventfd);
+    // Receives the fds sent by sendFds() and attaches. Blocks like recvmsg().
+    static std::unique_ptr<ShmRing> receiveFds(EventLoop* loop, int unixSockfd);
+
+    ~ShmRing();
+
+    bool sendFds(int unixSockfd) const;
+
+    // Producer side, one producer thread at a time. append() is all-or-nothing
+    // and returns false if the ring lacks room.
+    size_t writableBytes() const;
+    bool append(const void* data, size_t len);
+    bool append(const std::string& str) { return append(str.data(), str.size()); }
+
+    // Consumer side, loop thread. The callback fires when data arrives and
+    // reads with the Buffer-like calls below.
+    void setReadCallback(const ReadCallback& cb) { readCallback_ = cb; }
+    void startReading();
+    void stopReading();
+
+    size_t readableBytes() const;
+    const char* peek() const;
+    void retrieve(size_t len);
+    void retrieveAll() { retrieve(readableBytes()); }
+    std::string retrieveAllAsString();
+
+    size_t capacity() const;
+
+private:
+    struct Header;
+
+    ShmRing(EventLoop* loop, int memfd, int eventfd, Header* header,
+            std::unique_ptr<internal::CircularBuffer> ring);
+    size_t usedBytes(uint64_t head, uint64_t tail) const;
+    void handleRead();
+    void notify();
+
+    EventLoop* loop_;
+    const int memfd_;
+    const int eventfd_;
+    Header* header_;
+    std::unique_ptr<internal::CircularBuffer> ring_;
+    std::unique_ptr<Channel> channel_;
+    ReadCallback readCallback_;
+};
+
+} // namespace hvnetpp
@@ -1,7 +1,9 @@
 #pragma once
 
 #include <arpa/inet.h>
+#include <sys/socket.h>
 #include <sys/uio.h>
+#include <cstddef>
 
 namespace hvnetpp {
 namespace sockets {
@@ -9,13 +11,20 @@ namespace sockets {
 int createNonblockingOrDie(sa_family_t family);
 int createNonblockingUdpOrDie(sa_family_t family);
 int connect(int sockfd, const struct sockaddr* addr);
+int bind(int sockfd, const struct sockaddr* addr);
 void bindOrDie(int sockfd, const struct sockaddr* addr);
 void listenOrDie(int sockfd);
-int accept(int sockfd, struct sockaddr_in6* addr);
+int accept(int sockfd, struct sockaddr_storage* addr);
 ssize_t read(int sockfd, void *buf, size_t count);
 ssize_t readv(int sockfd, const struct iovec *iov, int iovcnt);
 ssize_t write(int sockfd, const void *buf, size_t count);
 void close(int sockfd);
+
+// Pass file descriptors over an AF_UNIX socket (SCM_RIGHTS) together with
+// a non-empty payload. recvFds sets *nfds to the number received, the fds
+// are close-on-exec.
+ssize_t sendFds(int sockfd, const int* fds, size_t nfds, const void* data, size_t len);
+ssize_t recvFds(int sockfd, int* fds, size_t* nfds, void* data, size_t len);
 void shutdownWrite(int sockfd);
 
 void toIpPort(char* buf, size_t size, const struct sockaddr* addr);
@@ -23,15 +32,20 @@ void toIp(char* buf, size_t size, const struct sockaddr* addr);
 void fromIpPort(const char* ip, uint16_t port, struct sockaddr_in* addr);
 void fromIpPort(const char* ip, uint16_t port, struct sockaddr_in6* addr);
 
+// Length of the address for bind/connect. An abstract AF_UNIX name ends at
+// its first NUL after the leading one.
+socklen_t sockaddrLength(const struct sockaddr* addr);
+
 int getSocketError(int sockfd);
 const struct sockaddr* sockaddr_cast(const struct sockaddr_in* addr);
 const struct sockaddr* sockaddr_cast(const struct sockaddr_in6* addr);
 struct sockaddr* sockaddr_cast(struct sockaddr_in6* addr);
+struct sockaddr* sockaddr_cast(struct sockaddr_storage* addr);
 const struct sockaddr_in* sockaddr_in_cast(const struct sockaddr* addr);
 const struct sockaddr_in6* sockaddr_in6_cast(const struct sockaddr* addr);
 
-struct sockaddr_in6 getLocalAddr(int sockfd);
-struct sockaddr_in6 getPeerAddr(int sockfd);
+struct sockaddr_storage getLocalAddr(int sockfd);
+struct sockaddr_storage getPeerAddr(int sockfd);
 bool isSelfConnect(int sockfd);
 
 // Socket options
@@ -40,5 +54,20 @@ void setReuseAddr(int sockfd, bool on);
 void setReusePort(int sockfd, bool on);
 void setKeepAlive(int sockfd, bool on);
 
+// Kernel software timestamps (SO_TIMESTAMPING), ns since the epoch.
+bool enableRxTimestamps(int sockfd);
+bool enableTxTimestamps(int sockfd);
+void disableTimestamps(int sockfd);
+// Receive timestamp carried by the control data of @c msg, 0 if none.
+int64_t rxTimestampNs(const struct msghdr& msg);
+
+struct TxTimestamp {
+    int64_t timestampNs;
+    int type;    // SCM_TSTAMP_SND or SCM_TSTAMP_ACK, -1 if unknown
+    uint32_t id; // OPT_ID counter, for TCP the offset of the last byte sent
+};
+// Pops one report off the error queue. Returns false once it is empty.
+bool readTxTimestamp(int sockfd, TxTimestamp* out);
+
 } // namespace sockets
 } // namespace hvnetpp
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <cstddef>
+#include <stdint.h>
+#include <string>
+
+namespace hvnetpp {
+
+class InetAddress;
+
+namespace stun {
+
+const uint32_t kMagicCookie = 0x2112A442;
+const size_t kHeaderSize = 20;
+const size_t kTransactionIdSize = 12;
+
+const uint16_t kBindingRequest = 0x0001;
+const uint16_t kBindingIndication = 0x0011;
+const uint16_t kBindingSuccess = 0x0101;
+
+// Message type = method | class.
+const uint16_t kClassRequest = 0x0000;
+const uint16_t kClassIndication = 0x0010;
+const uint16_t kClassSuccess = 0x0100;
+const uint16_t kClassError = 0x0110;
+const uint16_t kClassMask = 0x0110;
+
+// TURN methods (RFC 8656).
+const uint16_t kMethodBinding = 0x0001;
+const uint16_t kMethodAllocate = 0x0003;
+const uint16_t kMethodRefresh = 0x0004;
+const uint16_t kMethodSend = 0x0006;
+const uint16_t kMethodData = 0x0007;
+const uint16_t kMethodCreatePermission = 0x0008;
+const uint16_t kMethodChannelBind = 0x0009;
+
+const uint16_t kAttrUsername = 0x0006;
+const uint16_t kAttrMessageIntegrity = 0x0008;
+const uint16_t kAttrErrorCode = 0x0009;
+const uint16_t kAttrChannelNumber = 0x000C;
+const uint16_t kAttrLifetime = 0x000D;
+const uint16_t kAttrXorPeerAddress = 0x0012;
+const uint16_t kAttrData = 0x0013;
+const uint16_t kAttrRealm = 0x0014;
+const uint16_t kAttrNonce = 0x0015;
+const uint16_t kAttrXorRelayedAddress = 0x0016;
+const uint16_t kAttrRequestedTransport = 0x0019;
+const uint16_t kAttrXorMappedAddress = 0x0020;
+const uint16_t kAttrPriority = 0x0024;
+const uint16_t kAttrUseCandidate = 0x0025;
+const uint16_t kAttrFingerprint = 0x8028;
+const uint16_t kAttrIceControlled = 0x8029;
+const uint16_t kAttrIceControlling = 0x802A;
+
+// First-byte demultiplexing of a media port (RFC 7983).
+enum PacketClass {
+    kStunPacket,
+    kDtlsPacket,
+    kRtpPacket, // RTP or RTCP
+    kUnknownPacket,
+};
+
+inline PacketClass classify(const char* data, size_t len) {
+    if (len == 0) {
+        return kUnknownPacket;
+    }
+    const uint8_t b = static_cast<uint8_t>(data[0]);
+    if (b <= 3) {
+        return kStunPacket;
+    }
+    if (b >= 20 && b <= 63) {
+        return kDtlsPacket;
+    }
+    if (b >= 128 && b <= 191) {
+        return kRtpPacket;
+    }
+    return kUnknownPacket;
+}
+
+// HMAC-SHA1 key with the ipad/opad blocks already hashed, so checking a
+// message costs two SHA-1 compressions less than keying from scratch.
+struct IntegrityKey {
+    uint32_t inner[5];
+    uint32_t outer[5];
+};
+
+void prepareKey(const char* key, size_t len, IntegrityKey* out);
+// Long-term credential key: MD5(username ":" realm ":" password).
+void prepareLongTermKey(const std::string& username, const std::string& realm,
+                        const std::string& password, IntegrityKey* out);
+
+// Decodes an XOR-MAPPED/PEER/RELAYED-ADDRESS value; @c transactionId
+// unmasks IPv6 addresses.
+bool readXorAddress(const char* value, size_t len, const char* transactionId, InetAddress* out);
+
+} // namespace stun
+
+// Zero-copy view of a STUN message (RFC 5389). parse() walks the
+// attributes once, validates FINGERPRINT if present and remembers where
+// USERNAME and MESSAGE-INTEGRITY are.
+class StunMessage {
+public:
+    StunMessage() : data_(nullptr), size_(0), usernameOffset_(0), usernameSize_(0), integrityOffset_(0) {}
+
+    bool parse(const char* data, size_t len);
+
+    uint16_t type() const;
+    uint16_t method() const { return type() & ~stun::kClassMask; }
+    uint16_t messageClass() const { return type() & stun::kClassMask; }
+    const char* transactionId() const { return data_ + 8; }
+    // Attributes before MESSAGE-INTEGRITY only, as the RFC requires.
+    bool findAttribute(uint16_t type, const char** value, size_t* len) const;
+    // Iterates those attributes; start with *cursor == 0.
+    bool nextAttribute(size_t* cursor, uint16_t* type, const char** value, size_t* len) const;
+
+    bool hasUsername() const { return usernameOffset_ != 0; }
+    const char* username() const { return data_ + usernameOffset_; }
+    size_t usernameSize() const { return usernameSize_; }
+
+    bool hasIntegrity() const { return integrityOffset_ != 0; }
+    bool verifyIntegrity(const stun::IntegrityKey& key) const;
+
+private:
+    const char* data_;
+    size_t size_;
+    size_t usernameOffset_;
+    size_t usernameSize_;
+    size_t integrityOffset_; // start of the MESSAGE-INTEGRITY attribute
+};
+
+// Builds a STUN message into a caller-provided buffer. Adding past the
+// capacity marks the writer failed and size() returns 0.
+class StunWriter {
+public:
+    StunWriter(char* buf, size_t capacity, uint16_t type, const char* transactionId);
+
+    void addAttribute(uint16_t type, const char* value, size_t len);
+    void addUint32(uint16_t type, uint32_t value);
+    void addXorMappedAddress(const InetAddress& addr) { addXorAddress(stun::kAttrXorMappedAddress, addr); }
+    void addXorAddress(uint16_t type, const InetAddress& addr);
+    void addErrorCode(int code, const char* reason);
+    // Must come last, followed only by the fingerprint.
+    void addMessageIntegrity(const stun::IntegrityKey& key);
+    void addFingerprint();
+
+    const char* data() const { return buf_; }
+    size_t size() const { return ok_ ? size_ : 0; }
+
+private:
+    char* reserve(uint16_t type, size_t len);
+    void setLength(size_t bodySize);
+
+    char* buf_;
+    size_t capacity_;
+    size_t size_;
+    bool ok_;
+};
+
+} // namespace hvnetpp
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "hvnetpp/StunMessage.h"
+
+#include <functional>
+#include <string>
+#include <unordered_map>
+
+namespace hvnetpp {
+
+class InetAddress;
+class UdpSocket;
+
+// Answers ICE binding requests and consent checks (RFC 8445, RFC 7675)
+// straight from UdpSocket's read path: the request is checked against a
+// cache of prepared HMAC keys, looked up by the local ufrag of USERNAME,
+// and the response is built in a stack buffer. Nothing is allocated per
+// request. Requests with an unknown user or a bad MESSAGE-INTEGRITY are
+// dropped. Loop thread only; give each socket of a UdpServer its own.
+class StunResponder {
+public:
+    // Runs after a verified request was answered, e.g. to refresh consent
+    // or to act on USE-CANDIDATE.
+    using BindingCallback = std::function<void(const InetAddress& peerAddr, const StunMessage& request)>;
+    struct Stats {
+        uint64_t requests;
+        uint64_t responses;
+        uint64_t rejected; // malformed, unknown user or bad integrity
+    };
+
+    StunResponder();
+
+    // ICE short-term credentials: requests whose USERNAME is
+    // "<localUfrag>:<remoteUfrag>" are checked with @c password.
+    void addCredential(const std::string& localUfrag, const std::string& password);
+    void removeCredential(const std::string& localUfrag);
+    void setBindingCallback(BindingCallback cb) { bindingCallback_ = std::move(cb); }
+
+    // Returns true if the datagram was a binding request or indication and
+    // has been consumed; anything else, other STUN methods included, is
+    // left to the socket's callbacks.
+    bool handle(UdpSocket* socket, const InetAddress& peerAddr, const char* data, size_t len);
+
+    const Stats& stats() const { return stats_; }
+
+private:
+    struct Credential {
+        std::string ufrag;
+        stun::IntegrityKey key;
+    };
+
+    const Credential* findCredential(const char* ufrag, size_t len) const;
+
+    // Keyed by a hash of the ufrag so lookups need no temporary string.
+    std::unordered_multimap<uint64_t, Credential> credentials_;
+    BindingCallback bindingCallback_;
+    Stats stats_;
+};
+
+} // namespace hvnetpp
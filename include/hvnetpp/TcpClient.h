@@ -0,0 +1,63 @@
+#pragma once
+
+#include "hvnetpp/TcpConnection.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace hvnetpp {
+
+class Connector;
+class EventLoop;
+
+// Client-side counterpart of TcpServer: one connection to serverAddr,
+// optionally re-established with backoff after it drops.
+class TcpClient {
+public:
+    using ConnectionCallback = std::function<void(const TcpConnectionPtr&)>;
+    using MessageCallback = std::function<void(const TcpConnectionPtr&, Buffer*)>;
+    using WriteCompleteCallback = std::function<void(const TcpConnectionPtr&)>;
+
+    TcpClient(EventLoop* loop, const InetAddress& serverAddr, const std::string& nameArg);
+    ~TcpClient();
+
+    void connect();
+    void disconnect();
+    void stop();
+
+    TcpConnectionPtr connection() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return connection_;
+    }
+
+    EventLoop* getLoop() const { return loop_; }
+    const std::string& name() const { return name_; }
+    bool retry() const { return retry_; }
+    void enableRetry() { retry_ = true; }
+
+    void setConnectionCallback(const ConnectionCallback& cb) { connectionCallback_ = cb; }
+    void setMessageCallback(const MessageCallback& cb) { messageCallback_ = cb; }
+    void setWriteCompleteCallback(const WriteCompleteCallback& cb) { writeCompleteCallback_ = cb; }
+
+private:
+    void newConnection(int sockfd);
+    void removeConnection(const TcpConnectionPtr& conn);
+
+    EventLoop* loop_;
+    std::shared_ptr<Connector> connector_;
+    const std::string name_;
+    const std::shared_ptr<const std::string> connNamePrefix_;
+
+    ConnectionCallback connectionCallback_;
+    MessageCallback messageCallback_;
+    WriteCompleteCallback writeCompleteCallback_;
+
+    std::atomic<bool> retry_;
+    std::atomic<bool> connect_;
+    uint64_t nextConnId_; // always in loop thread
+    mutable std::mutex mutex_;
+    TcpConnectionPtr connection_; // guarded by mutex_
+};
+
+} // namespace hvnetpp
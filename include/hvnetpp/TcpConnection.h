@@ -1,18 +1,26 @@
 #pragma once
 
 #include "hvnetpp/Buffer.h"
+#include "hvnetpp/Channel.h"
 #include "hvnetpp/InetAddress.h"
 #include <atomic>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <functional>
+#include <utility>
+#include <vector>
 #include <netinet/in.h>
 
 namespace hvnetpp {
 
 class EventLoop;
-class Channel;
 class Socket; // Helper class for socket ops
+class TokenBucket;
+
+namespace sockets {
+struct TxTimestamp; // SocketsOps.h
+}
 
 class TcpConnection : public std::enable_shared_from_this<TcpConnection> {
 public:
@@ -22,56 +30,172 @@ public:
     using WriteCompleteCallback = std::function<void(const TcpConnectionPtr&)>;
     using HighWaterMarkCallback = std::function<void(const TcpConnectionPtr&, size_t)>;
     using CloseCallback = std::function<void(const TcpConnectionPtr&)>;
+    using TxTimestampCallback = std::function<void(const TcpConnectionPtr&, const sockets::TxTimestamp&)>;
 
     TcpConnection(EventLoop* loop,
                   const std::string& name,
                   int sockfd,
                   const InetAddress& localAddr,
                   const InetAddress& peerAddr);
+    // Name is "<namePrefix>#<id>", built on first use of name().
+    TcpConnection(EventLoop* loop,
+                  uint64_t id,
+                  const std::shared_ptr<const std::string>& namePrefix,
+                  int sockfd,
+                  const InetAddress& localAddr,
+                  const InetAddress& peerAddr);
     ~TcpConnection();
 
-    EventLoop* getLoop() const { return loop_; }
-    const std::string& name() const { return name_; }
+    EventLoop* getLoop() const { return loop_.load(std::memory_order_acquire); }
+    uint64_t id() const { return id_; }
+    const std::string& name() const;
     const InetAddress& localAddress() const { return localAddr_; }
     const InetAddress& peerAddress() const { return peerAddr_; }
     bool connected() const { return state() == kConnected; }
 
     void send(const std::string& message);
-    void send(Buffer* message);
+    void send(Buffer* message); // drains message
+    // Take ownership of the payload; from a non-loop thread it is moved into
+    // the queued functor instead of copied.
+    void send(std::string&& message);
+    void send(Buffer&& message);
+    void send(std::unique_ptr<Buffer> message);
     void shutdown();
+    void forceClose();
+    // Moves the connection to another loop without dropping buffered data,
+    // e.g. to rebalance hot connections. Thread safe. Callbacks run on the
+    // new loop afterwards. Only for TcpServer connections; TcpClient and
+    // ConnectionPool keep theirs on their own loop.
+    void migrateTo(EventLoop* target);
     void setTcpNoDelay(bool on);
 
+    // Pause/resume reading from the socket, thread safe.
+    void startRead();
+    void stopRead();
+    bool isReading() const { return reading_; } // NOT thread safe, may race with start/stopReadInLoop
+
+    // Traffic counters, read in loop thread.
+    uint64_t bytesReceived() const { return bytesReceived_; }
+    uint64_t bytesSent() const { return bytesSent_; }
+
+    // Built-in flow control: while more than @c highMark bytes are queued in
+    // this connection's output buffer, reading is paused on every linked
+    // source connection; it resumes once the buffer drains to @c lowMark.
+    // A proxy links the upstream to the downstream, an echo server links a
+    // connection to itself. Sources may live on other loops.
+    void setBackPressure(size_t highMark, size_t lowMark);
+    void addBackPressureSource(const TcpConnectionPtr& source);
+
+    // Bandwidth caps, metered in handleRead/handleWrite. When a bucket runs
+    // dry reading or writing pauses and a loop timer resumes it.
+    // A rate of 0 removes the limit. Call in loop thread.
+    void setReadRateLimit(double bytesPerSecond, size_t burst);
+    void setWriteRateLimit(double bytesPerSecond, size_t burst);
+    // Extra egress bucket shared with other connections, e.g. a server-wide cap.
+    void setSharedWriteLimiter(const std::shared_ptr<TokenBucket>& limiter) { sharedWriteLimiter_ = limiter; }
+
+    // Typed per-connection user state, e.g. a protocol session.
+    // getContext<T>() returns nullptr if the slot is empty or holds another type.
+    template <typename T>
+    void setContext(std::shared_ptr<T> context) {
+        context_ = std::move(context);
+        contextType_ = &ContextType<T>::id;
+    }
+    template <typename T, typename... Args>
+    T* emplaceContext(Args&&... args) {
+        std::shared_ptr<T> context = std::make_shared<T>(std::forward<Args>(args)...);
+        T* raw = context.get();
+        setContext(std::move(context));
+        return raw;
+    }
+    template <typename T>
+    T* getContext() const {
+        return contextType_ == &ContextType<T>::id ? static_cast<T*>(context_.get()) : nullptr;
+    }
+    void clearContext() { context_.reset(); contextType_ = nullptr; }
+
     void setConnectionCallback(const ConnectionCallback& cb) { connectionCallback_ = cb; }
-    void setMessageCallback(const MessageCallback& cb) { messageCallback_ = cb; }
+    // Safe to call from inside the message callback; takes effect once it returns.
+    void setMessageCallback(const MessageCallback& cb);
     void setWriteCompleteCallback(const WriteCompleteCallback& cb) { writeCompleteCallback_ = cb; }
+    // Kernel TX timestamps: reported when a send leaves the stack and when
+    // it is acked; the id is the offset, counted from this call, of the last
+    // byte of that send. Call in loop thread once connected; an empty cb
+    // turns timestamping off again.
+    void setTxTimestampCallback(const TxTimestampCallback& cb);
     void setHighWaterMarkCallback(const HighWaterMarkCallback& cb, size_t highWaterMark) { highWaterMarkCallback_ = cb; highWaterMark_ = highWaterMark; }
     
     // Internal use only
     void setCloseCallback(const CloseCallback& cb) { closeCallback_ = cb; }
     void connectEstablished();
     void connectDestroyed();
+    // Hot restart. handOffSocket() passes the fd, the unconsumed input and the
+    // unsent output to @c send. If it returns true the connection stops
+    // serving and closes its copy of the fd without running callbacks;
+    // otherwise nothing changes. restoreBuffers() preloads a fresh connection
+    // before connectEstablished(), which then flushes the output and delivers
+    // the input. Call in loop thread.
+    using SocketSender = std::function<bool(int sockfd, const Buffer& input, const Buffer& output)>;
+    bool handOffSocket(const SocketSender& send);
+    void restoreBuffers(Buffer* input, Buffer* output);
 
 private:
+    template <typename T>
+    struct ContextType {
+        static const char id;
+    };
+
     enum StateE { kDisconnected, kConnecting, kConnected, kDisconnecting };
     
     void handleRead();
+    void dispatchMessage(const TcpConnectionPtr& guardThis);
     void handleWrite();
     void handleClose();
     void handleError();
     void handleError(int err);
     void sendInLoop(const std::string& message);
     void sendInLoop(const void* message, size_t len);
+    void sendStringInLoop(std::string& message);
+    void sendBufferInLoop(Buffer& message);
+    void writeCompleteInLoop();
+    void highWaterMarkInLoop(size_t len);
+    void startShutdownInLoop();
     void shutdownInLoop();
+    void forceCloseInLoop();
+    void startReadInLoop();
+    void stopReadInLoop();
+    void pauseReadInLoop();
+    void resumeReadInLoop();
+    void updateReadingInLoop();
+    void applyBackPressureInLoop();
+    void releaseBackPressureInLoop();
+    size_t writeQuota(size_t len);
+    void consumeWriteQuota(size_t len);
+    void throttleReadInLoop();
+    void throttleWriteInLoop();
+    void resumeWriteInLoop();
+    void addBackPressureSourceInLoop(const std::weak_ptr<TcpConnection>& weakSource);
+    void migrateInLoop(EventLoop* target);
+    void attachInLoop(bool writing);
+    bool inOwnerLoop(void (TcpConnection::*method)());
     void closeSocket();
     StateE state() const { return state_.load(std::memory_order_acquire); }
     void setState(StateE s) { state_.store(s, std::memory_order_release); }
 
-    EventLoop* loop_;
-    const std::string name_;
+    void init();
+
+    std::atomic<EventLoop*> loop_; // changed only by migrateInLoop()
+    const uint64_t id_;
+    const std::shared_ptr<const std::string> namePrefix_;
+    mutable std::string name_;
+    mutable std::once_flag nameOnce_;
     std::atomic<StateE> state_;
     
     // We hold the fd but Channel doesn't own it.
-    std::unique_ptr<Channel> channel_;
+    // The channel is not tied: every handler that can call out to user code
+    // holds a strong ref, and owners always queue connectDestroyed(), so the
+    // connection can't die inside its own handleEvent().
+    Channel channel_;
     int socketFd_;
     
     InetAddress localAddr_;
@@ -79,10 +203,33 @@ private:
 
     ConnectionCallback connectionCallback_;
     MessageCallback messageCallback_;
+    MessageCallback pendingMessageCallback_;
+    bool handlingMessage_;
+    bool messageCallbackPending_;
     WriteCompleteCallback writeCompleteCallback_;
     HighWaterMarkCallback highWaterMarkCallback_;
+    TxTimestampCallback txTimestampCallback_;
     CloseCallback closeCallback_;
     size_t highWaterMark_;
+    bool txTimestamping_; // error queue may hold reports, keep draining it
+
+    bool reading_;
+    int readPauses_; // number of linked connections currently holding us back
+    size_t backPressureHigh_;
+    size_t backPressureLow_;
+    bool backPressured_;
+    std::vector<std::weak_ptr<TcpConnection>> backPressureSources_;
+
+    std::shared_ptr<TokenBucket> readLimiter_;
+    std::shared_ptr<TokenBucket> writeLimiter_;
+    std::shared_ptr<TokenBucket> sharedWriteLimiter_;
+    bool writeThrottled_;
+
+    std::shared_ptr<void> context_;
+    const char* contextType_;
+
+    uint64_t bytesReceived_;
+    uint64_t bytesSent_;
 
     Buffer inputBuffer_;
     Buffer outputBuffer_;
@@ -90,4 +237,7 @@ private:
 
 using TcpConnectionPtr = std::shared_ptr<TcpConnection>;
 
+template <typename T>
+const char TcpConnection::ContextType<T>::id = 0;
+
 } // namespace hvnetpp
@@ -1,7 +1,7 @@
 #pragma once
 
+#include "hvnetpp/FlatHashMap.h"
 #include "hvnetpp/TcpConnection.h"
-#include <map>
 #include <memory>
 #include <string>
 
@@ -9,6 +9,7 @@ namespace hvnetpp {
 class EventLoop;
 class Acceptor; // Helper for accept()
 class InetAddress;
+class TokenBucket;
 
 class TcpServer {
 public:
@@ -17,6 +18,8 @@ public:
     using WriteCompleteCallback = std::function<void(const TcpConnectionPtr&)>;
 
     TcpServer(EventLoop* loop, const InetAddress& listenAddr, const std::string& nameArg);
+    // Serves on an already bound socket, e.g. from receiveListenFd().
+    TcpServer(EventLoop* loop, int listenFd, const std::string& nameArg);
     ~TcpServer();
 
     void start();
@@ -25,24 +28,50 @@ public:
     void setMessageCallback(const MessageCallback& cb) { messageCallback_ = cb; }
     void setWriteCompleteCallback(const WriteCompleteCallback& cb) { writeCompleteCallback_ = cb; }
 
+    // Per-connection caps applied to every new connection, 0 disables.
+    void setConnectionRateLimit(double readBytesPerSecond, double writeBytesPerSecond, size_t burst);
+    // Cap on the total egress of all connections of this server, 0 disables.
+    void setTotalWriteRateLimit(double bytesPerSecond, size_t burst);
+
+    // Hot restart over a blocking AF_UNIX stream socket. The old process
+    // calls handOff() in the loop thread: it passes the listener and, if
+    // asked, every connection of this loop with its pending input/output,
+    // then stops serving them without closing them. The new process calls
+    // receiveListenFd(), builds a TcpServer on that fd, installs callbacks,
+    // calls adoptConnections() in the loop thread and start().
+    // Each handed-off connection gets the connection callback with
+    // connected() false, as if it had closed. If the stream breaks, the
+    // connection being sent and the remaining ones stay here untouched, with
+    // no callbacks; @c transferred tells how many went.
+    bool handOff(int unixSockfd, bool includeConnections, size_t* transferred = nullptr);
+    static int receiveListenFd(int unixSockfd);
+    size_t adoptConnections(int unixSockfd);
+
 private:
     void newConnection(int sockfd, const InetAddress& peerAddr);
+    void establishConnection(int sockfd, const InetAddress& peerAddr, Buffer* input, Buffer* output);
     void removeConnection(const TcpConnectionPtr& conn);
     void removeConnectionInLoop(const TcpConnectionPtr& conn);
 
-    using ConnectionMap = std::map<std::string, TcpConnectionPtr>;
+    using ConnectionMap = FlatHashMap<uint64_t, TcpConnectionPtr>;
 
     EventLoop* loop_;
     const std::string ipPort_;
     const std::string name_;
+    const std::shared_ptr<const std::string> connNamePrefix_;
     
     std::shared_ptr<Acceptor> acceptor_; // Internal class to handle bind/listen/accept
     
     ConnectionCallback connectionCallback_;
     MessageCallback messageCallback_;
     WriteCompleteCallback writeCompleteCallback_;
+
+    double readRateLimit_;
+    double writeRateLimit_;
+    size_t rateLimitBurst_;
+    std::shared_ptr<TokenBucket> totalWriteLimiter_;
     
-    int nextConnId_;
+    uint64_t nextConnId_;
     ConnectionMap connections_;
 };
 
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "hvnetpp/TimerId.h"
+
+#include <functional>
+#include <stdint.h>
+#include <vector>
+
+namespace hvnetpp {
+
+class EventLoop;
+
+// Coarse expiry for many objects with one loop timer: ids are dropped into
+// the bucket @c ticks ahead of the cursor and handed to the callback when
+// the cursor gets there. Refreshing an object doesn't touch the wheel; the
+// callback checks the object's own deadline and schedules it again if it
+// is not due yet. Loop thread only.
+class TimingWheel {
+public:
+    using ExpireCallback = std::function<void(uint64_t id)>;
+
+    TimingWheel(EventLoop* loop, size_t slots, double tickSeconds, ExpireCallback cb);
+    ~TimingWheel();
+
+    // @c ticks is clamped to [1, slots - 1].
+    void schedule(uint64_t id, uint32_t ticks);
+    // Ticks since construction, the wheel's clock for deadlines.
+    uint32_t now() const { return now_; }
+
+private:
+    void tick();
+
+    EventLoop* loop_;
+    ExpireCallback expireCallback_;
+    std::vector<std::vector<uint64_t>> buckets_;
+    std::vector<uint64_t> firing_;
+    uint32_t now_;
+    TimerId timer_;
+};
+
+} // namespace hvnetpp
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "hvnetpp/Timer.h"
+#include <cstddef>
+#include <mutex>
+
+namespace hvnetpp {
+
+// Byte rate limiter refilled at @c rate bytes per second up to @c burst.
+// A burst of 0 means one second's worth, at least one byte.
+// consume() may drive the bucket into debt, which later refills pay back.
+// Thread safe, so one bucket can cap the aggregate of many connections.
+class TokenBucket {
+public:
+    TokenBucket(double bytesPerSecond, size_t burst);
+
+    // Whole tokens available right now, 0 while in debt.
+    size_t available();
+    void consume(size_t bytes);
+
+    // Seconds until enough tokens accumulate to be worth waking up for.
+    double refillDelay();
+
+    double rate() const { return rate_; }
+    size_t burst() const { return burst_; }
+
+private:
+    void refill(Timestamp now);
+
+    const double rate_;
+    const size_t burst_;
+    std::mutex mutex_;
+    double tokens_;
+    Timestamp last_;
+};
+
+} // namespace hvnetpp
@@ -0,0 +1,139 @@
+#pragma once
+
+#include "hvnetpp/FlatHashMap.h"
+#include "hvnetpp/InetAddress.h"
+#include "hvnetpp/StunMessage.h"
+#include "hvnetpp/TimerId.h"
+
+#include <cstring>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace hvnetpp {
+
+class EventLoop;
+class TimingWheel;
+class UdpSocket;
+
+// TURN relay over UDP (RFC 8656) with long-term credentials. Each
+// allocation gets its own relay UdpSocket on @c relayIp. Allocations,
+// permissions and channel bindings live in FlatHashMaps; lifetimes are
+// kept by a one-second TimingWheel, and permissions and channels are also
+// checked on use. The NONCE is replaced every five minutes and the one
+// before stays valid for five more; older ones get 438 Stale Nonce with
+// the current one. Channel data goes to the client with a 4-byte
+// ChannelData header in front of the peer's datagram via one sendmsg(),
+// and from the client to the peer straight from the receive buffer.
+// Loop thread only; run one server per loop with SO_REUSEPORT to scale.
+class TurnServer {
+public:
+    struct Stats {
+        uint64_t allocations;   // currently active
+        uint64_t toPeerPackets;
+        uint64_t toPeerBytes;
+        uint64_t toClientPackets;
+        uint64_t toClientBytes;
+        uint64_t dropped;       // no allocation, permission or channel
+    };
+
+    // @c relayIp's port is ignored; relay ports are picked by the kernel.
+    TurnServer(EventLoop* loop, const InetAddress& listenAddr, const InetAddress& relayIp,
+               const std::string& realm, const std::string& name);
+    ~TurnServer();
+
+    void addUser(const std::string& username, const std::string& password);
+    void removeUser(const std::string& username);
+    void setMaxAllocations(size_t n) { maxAllocations_ = n; }
+
+    void start();
+
+    const Stats& stats() const { return stats_; }
+    const std::string& name() const { return name_; }
+
+private:
+    // Address and port as a flat hash key.
+    struct AddrKey {
+        AddrKey() : family(0), port(0) { memset(ip, 0, sizeof ip); }
+        AddrKey(const InetAddress& addr, bool withPort);
+        bool operator==(const AddrKey& rhs) const {
+            return family == rhs.family && port == rhs.port && memcmp(ip, rhs.ip, sizeof ip) == 0;
+        }
+        uint16_t family;
+        uint16_t port;
+        uint8_t ip[16];
+    };
+    struct AddrKeyHash {
+        size_t operator()(const AddrKey& key) const;
+    };
+    struct Channel {
+        Channel() : peer(), expiry(0) {}
+        InetAddress peer;
+        uint32_t expiry;
+    };
+    struct Allocation {
+        uint64_t id;
+        InetAddress client;
+        AddrKey clientKey;
+        std::string username; // owner, checked on every later request
+        stun::IntegrityKey key;
+        std::unique_ptr<UdpSocket> relay;
+        InetAddress relayAddr;
+        uint32_t expiry;
+        char transactionId[stun::kTransactionIdSize]; // of the Allocate, for retransmits
+        FlatHashMap<AddrKey, uint32_t, AddrKeyHash> permissions; // peer ip -> expiry
+        FlatHashMap<uint16_t, Channel> channels;
+        FlatHashMap<AddrKey, uint16_t, AddrKeyHash> channelByPeer;
+    };
+
+    void onClientPacket(const InetAddress& client, const char* data, size_t len);
+    void onChannelData(const InetAddress& client, const char* data, size_t len);
+    void onRelayPacket(Allocation* alloc, const InetAddress& peer, const char* data, size_t len);
+    void onRequest(const InetAddress& client, const StunMessage& request);
+    void onSendIndication(const InetAddress& client, const StunMessage& indication);
+
+    void handleAllocate(const InetAddress& client, const StunMessage& request,
+                        const std::string& username, const stun::IntegrityKey& key);
+    void handleRefresh(Allocation* alloc, const StunMessage& request);
+    void handleCreatePermission(Allocation* alloc, const StunMessage& request);
+    void handleChannelBind(Allocation* alloc, const StunMessage& request);
+
+    // Adds MESSAGE-INTEGRITY when @c key is given, then FINGERPRINT.
+    void reply(const InetAddress& client, StunWriter& writer, const stun::IntegrityKey* key);
+    void sendError(const InetAddress& client, const StunMessage& request, int code,
+                   const char* reason, const stun::IntegrityKey* key);
+    // 401/438 carry REALM and NONCE so the client can (re)authenticate.
+    void sendChallenge(const InetAddress& client, const StunMessage& request, int code, const char* reason);
+    void sendAllocateSuccess(const InetAddress& client, const StunMessage& request, const Allocation& alloc);
+
+    bool permitted(Allocation* alloc, const InetAddress& peer);
+    void addPermission(Allocation* alloc, const InetAddress& peer);
+    void onExpire(uint64_t id);
+    void rotateNonce();
+    bool nonceValid(const char* nonce, size_t len) const;
+    void destroyAllocation(Allocation* alloc);
+
+    EventLoop* loop_;
+    const InetAddress listenAddr_;
+    const InetAddress relayIp_;
+    const std::string realm_;
+    const std::string name_;
+    std::string nonce_;
+    std::string previousNonce_; // still accepted until the next rotation
+    TimerId nonceTimer_;
+    std::unique_ptr<UdpSocket> socket_;
+    // One receive buffer for all relay sockets; they are read on loop_ only.
+    std::shared_ptr<std::vector<char>> relayReadBuf_;
+    std::unique_ptr<TimingWheel> wheel_;
+    std::unordered_map<std::string, stun::IntegrityKey> users_;
+    FlatHashMap<AddrKey, std::unique_ptr<Allocation>, AddrKeyHash> allocations_; // by client
+    FlatHashMap<uint64_t, Allocation*> allocationsById_;
+    uint64_t nextId_;
+    size_t maxAllocations_;
+    std::vector<char> scratch_; // Data indications are built here
+    uint32_t indicationSeq_;
+    Stats stats_;
+};
+
+} // namespace hvnetpp
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "hvnetpp/InetAddress.h"
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace hvnetpp {
+
+class EventLoop;
+class EventLoopThreadPool;
+class UdpSocket;
+
+// One UdpSocket per loop, all bound to the same port with SO_REUSEPORT, so
+// the kernel spreads datagrams over the loops. The default reuseport hash
+// already keeps a peer on one socket; setSteering() instead attaches a CBPF
+// program that picks the socket from a hash of the peer address and port
+// modulo the socket count, so the mapping is stable and predictable.
+class UdpServer {
+public:
+    // Runs on the loop of @c socket; reply through it.
+    using PacketCallback = std::function<void(UdpSocket* socket, const InetAddress& peerAddr,
+                                              const char* data, size_t len)>;
+    using SocketInitCallback = std::function<void(UdpSocket* socket)>;
+
+    UdpServer(EventLoop* loop, const InetAddress& listenAddr, const std::string& name);
+    ~UdpServer();
+
+    // 0 (the default) serves on the base loop only. Call before start().
+    void setThreadNum(int numThreads);
+    void setSteering(bool on) { steering_ = on; }
+    void setPacketCallback(const PacketCallback& cb) { packetCallback_ = cb; }
+    // Runs on each socket's loop before it is bound, e.g. to enable batch read.
+    void setSocketInitCallback(const SocketInitCallback& cb) { socketInitCallback_ = cb; }
+
+    // Call in the base loop thread.
+    void start();
+
+    const std::string& name() const { return name_; }
+    // Valid after start(); socket(i) lives on socketLoop(i).
+    size_t numSockets() const { return sockets_.size(); }
+    UdpSocket* socket(size_t i) const { return sockets_[i].get(); }
+    EventLoop* socketLoop(size_t i) const { return loops_[i]; }
+
+private:
+    void openSocket(EventLoop* loop, size_t index);
+    void attachSteeringProgram();
+
+    EventLoop* loop_;
+    const InetAddress listenAddr_;
+    const std::string name_;
+    std::unique_ptr<EventLoopThreadPool> threadPool_;
+    bool steering_;
+    bool started_;
+    PacketCallback packetCallback_;
+    SocketInitCallback socketInitCallback_;
+    std::vector<std::unique_ptr<UdpSocket>> sockets_; // sockets_[i] lives on loops_[i]
+    std::vector<EventLoop*> loops_;
+};
+
+} // namespace hvnetpp
@@ -3,42 +3,176 @@
 #include <memory>
 #include <functional>
 #include <vector>
+#include <sys/socket.h>
 #include "hvnetpp/InetAddress.h"
+#include "hvnetpp/LivenessGuard.h"
 
 namespace hvnetpp {
 
 class EventLoop;
 class Channel;
 class Buffer;
+class StunResponder;
+
+// A received datagram; data points into the socket's receive area and is
+// valid only during the callback.
+struct UdpPacket {
+    const char* data;
+    size_t len;
+    InetAddress peer;
+    int64_t timestampNs; // kernel receive time, 0 unless timestamping is on
+};
 
 class UdpSocket {
 public:
     using ReadCallback = std::function<void(const InetAddress& peerAddr, Buffer* buf)>;
+    using BatchReadCallback = std::function<void(const UdpPacket* packets, size_t count)>;
+    // Zero-copy alternative to ReadCallback: @c data points into the receive
+    // area and is valid only during the call. No per-packet allocation.
+    using PacketCallback = std::function<void(const InetAddress& peerAddr, const char* data, size_t len)>;
+
+    enum DropPolicy { kDropNewest, kDropOldest };
+    struct SendQueueStats {
+        uint64_t sent;
+        uint64_t dropped; // queue full
+        uint64_t errors;  // rejected by the kernel, e.g. EMSGSIZE
+    };
     
     UdpSocket(EventLoop* loop, const std::string& name);
     ~UdpSocket();
 
+    // Aborts if the address can't be bound.
     bool bind(const InetAddress& addr);
+    // Like bind() but returns false with errno set and the socket closed,
+    // e.g. for ephemeral ports bound on behalf of remote clients.
+    bool tryBind(const InetAddress& addr);
     void setReadCallback(ReadCallback cb) { readCallback_ = std::move(cb); }
+    // Takes precedence over the read callback.
+    void setPacketCallback(PacketCallback cb) { packetCallback_ = std::move(cb); }
+
+    // Receive with recvmmsg(), up to @c batchSize datagrams of at most
+    // @c maxPacketSize bytes per call into preallocated buffers, repeated
+    // per wakeup until EAGAIN or @c budget datagrams. Batches go to the
+    // batch callback, or packet by packet to the packet or read callback.
+    void enableBatchRead(size_t batchSize = 32, size_t maxPacketSize = 2048, size_t budget = 256);
+    void setBatchReadCallback(BatchReadCallback cb) { batchReadCallback_ = std::move(cb); }
+
+    // Receive buffer of the packet-by-packet read path, kReadBufferSize
+    // bytes, allocated on the first read unless set here. It only holds a
+    // datagram while its callbacks run, so sockets of one loop can share
+    // one, e.g. thousands of TURN relay sockets.
+    static const size_t kReadBufferSize = 65536; // max UDP datagram
+    void setReadBuffer(const std::shared_ptr<std::vector<char>>& buffer) { readBuf_ = buffer; }
+
+    // STUN binding requests are answered by @c responder before any read
+    // callback sees them. Not owned; nullptr detaches.
+    void setStunResponder(StunResponder* responder) { stunResponder_ = responder; }
     
-    // Send data to destination
+    // Queue sends made in the loop thread and flush them with sendmmsg()
+    // once the current loop iteration is done. On EAGAIN the rest waits for
+    // write readiness. At most @c maxPackets wait; beyond that the policy
+    // decides which packet is dropped. Sends from other threads bypass the
+    // queue with a plain sendto(), so they may overtake queued packets.
+    void enableSendQueue(size_t maxPackets = 1024, DropPolicy policy = kDropNewest);
+    const SendQueueStats& sendQueueStats() const { return sendStats_; }
+    size_t queuedPackets() const { return sendQueueSize_; }
+
+    // Send data to destination. With the send queue enabled and called in
+    // the loop thread, returns @c len once queued, or -1 with errno ENOBUFS
+    // if dropped; otherwise the result of sendto().
     ssize_t sendTo(const void* data, size_t len, const InetAddress& destAddr);
     ssize_t sendTo(Buffer* buf, const InetAddress& destAddr);
 
+    // UDP GSO: sends @c len bytes as datagrams of @c segmentSize bytes (the
+    // last may be shorter) with one sendmsg(); the kernel does the split.
+    // At most 64KB and 64 segments per call. Falls back to one sendto() per
+    // segment if the kernel or device refuses. Bypasses the send queue.
+    ssize_t sendSegmentsTo(const void* data, size_t len, size_t segmentSize, const InetAddress& destAddr);
+
+    // UDP GRO: lets the kernel coalesce datagrams of a flow; they are split
+    // again before the read callbacks run. Call after bind(). With batch
+    // read, maxPacketSize must be large enough for a coalesced buffer (64KB).
+    bool enableGro();
+
+    // Kernel receive timestamps (SO_TIMESTAMPING, software). Batches carry
+    // them in UdpPacket; packet and read callbacks get them from
+    // receiveTimestampNs(). Call after bind().
+    bool enableTimestamping();
+    // Nanoseconds since the epoch of the datagram being delivered, valid
+    // inside a callback only.
+    int64_t receiveTimestampNs() const { return receiveTimestampNs_; }
+
+    // Per-peer fast path: a new socket on the same loop, bound to this
+    // socket's local address with SO_REUSEPORT and connect()ed to @c peer.
+    // The kernel then demuxes @c peer's datagrams to it without a
+    // per-packet route lookup. Datagrams for other peers that reached it
+    // before connect() are passed to this socket's callbacks. Callbacks
+    // and options are not copied. Call in loop thread, after bind().
+    // Returns nullptr on failure.
+    std::unique_ptr<UdpSocket> connectPeer(const InetAddress& peer);
+    bool connected() const { return connected_; }
+    const InetAddress& peerAddress() const { return peerAddr_; }
+    // Connected sockets only; goes through the send queue like sendTo().
+    // sendTo() the peer on a connected socket takes this path as well, so
+    // the kernel keeps using the socket's cached route.
+    ssize_t send(const void* data, size_t len);
+
     int fd() const { return sockfd_; }
 
 private:
     bool ensureSocket(sa_family_t family);
     void handleRead();
+    void handleBatchRead();
+    void deliver(const char* data, size_t len, size_t segmentSize, const InetAddress& peer);
+    void handleWrite();
+    ssize_t queueSendTo(const void* data, size_t len, const InetAddress* destAddr);
+    bool isPeer(const InetAddress& addr) const;
+    void flushSendQueue();
+    std::vector<char>& readBuffer();
 
     EventLoop* loop_;
     const std::string name_;
     sa_family_t family_;
     int sockfd_;
     std::shared_ptr<Channel> channel_;
-    std::shared_ptr<bool> callbackToken_;
+    LivenessGuard liveness_;
     ReadCallback readCallback_;
-    std::vector<char> readBuf_; // UDP packet buffer
+    PacketCallback packetCallback_;
+    StunResponder* stunResponder_;
+    bool connected_;
+    InetAddress peerAddr_;
+    std::shared_ptr<std::vector<char>> readBuf_; // see setReadBuffer()
+
+    // recvmmsg state, sized by enableBatchRead().
+    BatchReadCallback batchReadCallback_;
+    size_t batchSize_;
+    size_t maxPacketSize_;
+    size_t readBudget_;
+    std::vector<char> batchBuf_;
+    std::vector<struct mmsghdr> batchMsgs_;
+    std::vector<struct iovec> batchIovecs_;
+    std::vector<struct sockaddr_storage> batchAddrs_;
+    std::vector<UdpPacket> batchPackets_;
+    std::vector<char> batchControl_;
+    bool groEnabled_;
+    bool gsoSupported_;
+    bool timestamping_;
+    int64_t receiveTimestampNs_;
+
+    // sendmmsg queue: a ring of slots whose storage is reused.
+    struct QueuedPacket {
+        std::vector<char> data;
+        InetAddress dest;
+        bool toPeer; // connected socket: sent without an address
+    };
+    std::vector<QueuedPacket> sendQueue_;
+    size_t sendQueueHead_;
+    size_t sendQueueSize_;
+    DropPolicy dropPolicy_;
+    bool flushPending_;
+    SendQueueStats sendStats_;
+    std::vector<struct mmsghdr> sendMsgs_;
+    std::vector<struct iovec> sendIovecs_;
 };
 
 } // namespace hvnetpp
@@ -1,6 +1,7 @@
 #include "hvnetpp/Channel.h"
 #include "hvnetpp/EventLoop.h"
 #include <sys/epoll.h>
+#include <assert.h>
 
 namespace hvnetpp {
 
@@ -16,7 +17,8 @@ Channel::Channel(EventLoop* loop, int fd)
       index_(-1),
       eventHandling_(false),
       addedToLoop_(false),
-      tied_(false) {
+      tied_(false),
+      livenessTied_(false) {
 }
 
 Channel::~Channel() {
@@ -27,6 +29,11 @@ void Channel::tie(const std::shared_ptr<void>& obj) {
     tied_ = true;
 }
 
+void Channel::tie(const LivenessGuard& guard) {
+    liveness_ = guard.watch();
+    livenessTied_ = true;
+}
+
 void Channel::update() {
     if (!addedToLoop_ && isNoneEvent()) {
         return;
@@ -36,6 +43,9 @@ void Channel::update() {
 }
 
 void Channel::handleEvent() {
+    if (livenessTied_ && !liveness_.alive()) {
+        return;
+    }
     std::shared_ptr<void> guard;
     if (tied_) {
         guard = tie_.lock();
@@ -63,6 +73,11 @@ void Channel::handleEventWithGuard() {
     eventHandling_ = false;
 }
 
+void Channel::setOwnerLoop(EventLoop* loop) {
+    assert(!addedToLoop_ && !eventHandling_);
+    loop_ = loop;
+}
+
 void Channel::remove() {
     if (!addedToLoop_) {
         return;
@@ -22,6 +22,14 @@ CircularBuffer::CircularBuffer(unsigned int order)
     createBufferMirror();
 }
 
+CircularBuffer::CircularBuffer(int fd, size_t offset, unsigned int order)
+    : size_(1UL << order),
+      data_(nullptr),
+      head_(0),
+      tail_(0) {
+    mapMirror(fd, offset);
+}
+
 CircularBuffer::~CircularBuffer() {
     if (data_) {
         munmap(data_, size_ << 1);
@@ -66,31 +74,31 @@ void CircularBuffer::createBufferMirror() {
         return;
     }
 
+    mapMirror(fd, 0);
+    close(fd);
+}
+
+void CircularBuffer::mapMirror(int fd, size_t offset) {
     // create the array of data
     data_ = static_cast<unsigned char*>(mmap(NULL, size_ << 1, PROT_NONE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0));
     if (data_ == MAP_FAILED) {
         data_ = nullptr;
-        close(fd);
         return;
     }
 
-    void* address = mmap(data_, size_, PROT_READ | PROT_WRITE, MAP_FIXED | MAP_SHARED, fd, 0);
+    void* address = mmap(data_, size_, PROT_READ | PROT_WRITE, MAP_FIXED | MAP_SHARED, fd, offset);
     if (address != data_) {
         munmap(data_, size_ << 1);
         data_ = nullptr;
-        close(fd);
         return;
     }
 
-    address = mmap(data_ + size_, size_, PROT_READ | PROT_WRITE, MAP_FIXED | MAP_SHARED, fd, 0);
+    address = mmap(data_ + size_, size_, PROT_READ | PROT_WRITE, MAP_FIXED | MAP_SHARED, fd, offset);
     if (address != data_ + size_) {
         munmap(data_, size_ << 1);
         data_ = nullptr;
-        close(fd);
         return;
     }
-
-    close(fd);
 }
 
 } // namespace internal
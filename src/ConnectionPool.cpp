@@ -0,0 +1,332 @@
+#include "hvnetpp/ConnectionPool.h"
+#include "hvnetpp/Connector.h"
+#include "hvnetpp/EventLoop.h"
+#include "hvnetpp/PoolAllocator.h"
+#include "hvnetpp/SocketsOps.h"
+#include "rtclog.h"
+#include <algorithm>
+#include <assert.h>
+#include <cstring>
+
+namespace hvnetpp {
+
+namespace {
+
+const double kEvictIntervalSeconds = 1.0;
+const int kInitRetryDelayMs = 500;
+const int kMaxRetryDelayMs = 30 * 1000;
+
+void discardIdleMessage(const TcpConnectionPtr& conn, Buffer* buf) {
+    RTCLOG(RTC_WARN, "ConnectionPool %s got %zu bytes while idle, dropped",
+           conn->name().c_str(), buf->readableBytes());
+    buf->retrieveAll();
+}
+
+} // namespace
+
+ConnectionPool::HostKey::HostKey(const InetAddress& a)
+    : family(a.family()),
+      port(a.portNetEndian()) {
+    memset(addr, 0, sizeof addr);
+    if (family == AF_INET6) {
+        memcpy(addr, &sockets::sockaddr_in6_cast(a.getSockAddr())->sin6_addr, 16);
+    } else if (family == AF_UNIX) {
+        port = 0;
+        path = a.toIp();
+    } else {
+        memcpy(addr, &sockets::sockaddr_in_cast(a.getSockAddr())->sin_addr, 4);
+    }
+}
+
+bool ConnectionPool::HostKey::operator==(const HostKey& rhs) const {
+    return family == rhs.family && port == rhs.port
+        && memcmp(addr, rhs.addr, sizeof addr) == 0 && path == rhs.path;
+}
+
+size_t ConnectionPool::HostKeyHash::operator()(const HostKey& key) const {
+    // FNV-1a over the address bytes, port and family.
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < sizeof key.addr; ++i) {
+        h = (h ^ key.addr[i]) * 1099511628211ULL;
+    }
+    h = (h ^ key.port) * 1099511628211ULL;
+    h = (h ^ key.family) * 1099511628211ULL;
+    if (!key.path.empty()) {
+        h ^= std::hash<std::string>()(key.path);
+    }
+    return static_cast<size_t>(h);
+}
+
+ConnectionPool::Host::Host(const InetAddress& a)
+    : addr(a),
+      total(0),
+      failures(0),
+      retryDelayMs(kInitRetryDelayMs) {
+}
+
+ConnectionPool::ConnectionPool(EventLoop* loop, const std::string& name)
+    : loop_(loop),
+      name_(name),
+      connNamePrefix_(std::make_shared<const std::string>(name_)),
+      maxPerHost_(64),
+      idleTimeout_(60.0),
+      failureThreshold_(3),
+      cooldown_(5.0),
+      nextConnId_(1) {
+    evictTimer_ = loop_->runEvery(kEvictIntervalSeconds, [this]() { evictIdle(); });
+}
+
+ConnectionPool::~ConnectionPool() {
+    loop_->assertInLoopThread();
+    loop_->cancel(evictTimer_);
+    for (const auto& connector : connectors_) {
+        connector->stop();
+    }
+    for (const auto& item : connections_) {
+        item.second.conn->forceClose();
+    }
+    for (auto& item : hosts_) {
+        for (const auto& waiter : item.second.waiters) {
+            waiter(TcpConnectionPtr());
+        }
+    }
+}
+
+void ConnectionPool::setHealthThreshold(int failures, double cooldownSeconds) {
+    failureThreshold_ = failures;
+    cooldown_ = cooldownSeconds;
+}
+
+size_t ConnectionPool::idleCount(const InetAddress& backend) const {
+    auto it = hosts_.find(HostKey(backend));
+    return it == hosts_.end() ? 0 : it->second.idle.size();
+}
+
+size_t ConnectionPool::totalCount(const InetAddress& backend) const {
+    auto it = hosts_.find(HostKey(backend));
+    return it == hosts_.end() ? 0 : it->second.total;
+}
+
+ConnectionPool::Host& ConnectionPool::hostFor(const InetAddress& backend) {
+    HostKey key(backend);
+    auto it = hosts_.find(key);
+    if (it == hosts_.end()) {
+        it = hosts_.insert(std::make_pair(key, Host(backend))).first;
+    }
+    return it->second;
+}
+
+// nullptr for connections that aren't ours.
+ConnectionPool::Member* ConnectionPool::memberOf(const TcpConnectionPtr& conn) {
+    auto it = connections_.find(conn->id());
+    if (it == connections_.end() || it->second.conn != conn) {
+        return nullptr;
+    }
+    return &it->second;
+}
+
+void ConnectionPool::checkout(const InetAddress& backend, const CheckoutCallback& cb) {
+    loop_->assertInLoopThread();
+    Host& host = hostFor(backend);
+    if (host.downUntil > std::chrono::steady_clock::now()) {
+        cb(TcpConnectionPtr());
+        return;
+    }
+    while (!host.idle.empty()) {
+        TcpConnectionPtr conn = std::move(host.idle.back().conn);
+        host.idle.pop_back();
+        if (conn->connected()) {
+            conn->setMessageCallback(TcpConnection::MessageCallback());
+            cb(conn);
+            return;
+        }
+    }
+    host.waiters.push_back(cb);
+    if (host.total < maxPerHost_) {
+        startConnect(host);
+    }
+}
+
+void ConnectionPool::checkin(const TcpConnectionPtr& conn) {
+    loop_->assertInLoopThread();
+    assert(conn->getLoop() == loop_);
+    // A resolved or redirected backend may not match the peer address.
+    Member* member = memberOf(conn);
+    if (!member) {
+        return;
+    }
+    auto it = hosts_.find(member->backend);
+    if (it == hosts_.end()) {
+        return;
+    }
+    if (conn->connected()) {
+        release(it->second, conn);
+    }
+}
+
+// Give the connection to the oldest waiter, or park it as idle.
+void ConnectionPool::release(Host& host, const TcpConnectionPtr& conn) {
+    if (!host.waiters.empty()) {
+        CheckoutCallback cb = std::move(host.waiters.front());
+        host.waiters.pop_front();
+        conn->setMessageCallback(TcpConnection::MessageCallback());
+        cb(conn);
+        return;
+    }
+    conn->setMessageCallback(&discardIdleMessage);
+    IdleEntry entry;
+    entry.conn = conn;
+    entry.since = std::chrono::steady_clock::now();
+    host.idle.push_back(std::move(entry));
+}
+
+void ConnectionPool::startConnect(Host& host) {
+    ++host.total;
+    ConnectorPtr connector = std::make_shared<Connector>(loop_, host.addr);
+    Connector* raw = connector.get();
+    InetAddress backend = host.addr;
+    connector->setRetry(false);
+    connector->setNewConnectionCallback([this, raw, backend](int sockfd) {
+        retireConnector(raw);
+        newConnection(backend, sockfd);
+    });
+    connector->setConnectFailedCallback([this, raw, backend]() {
+        retireConnector(raw);
+        connectFailed(backend);
+    });
+    connectors_.push_back(connector);
+    connector->start();
+}
+
+// Called from inside the connector's handler, so drop it later.
+void ConnectionPool::retireConnector(Connector* connector) {
+    LivenessGuard::Watcher watcher = liveness_.watch();
+    loop_->queueInLoop([this, watcher, connector]() {
+        if (!watcher.alive()) {
+            return;
+        }
+        auto it = std::find_if(connectors_.begin(), connectors_.end(),
+                               [connector](const ConnectorPtr& c) { return c.get() == connector; });
+        if (it != connectors_.end()) {
+            connectors_.erase(it);
+        }
+    });
+}
+
+void ConnectionPool::newConnection(const InetAddress& backend, int sockfd) {
+    loop_->assertInLoopThread();
+    InetAddress peerAddr(sockets::getPeerAddr(sockfd));
+    InetAddress localAddr(sockets::getLocalAddr(sockfd));
+    TcpConnectionPtr conn = std::allocate_shared<TcpConnection>(internal::PoolAllocator<TcpConnection>(),
+        loop_, nextConnId_++, connNamePrefix_, sockfd, localAddr, peerAddr);
+    EventLoop* loop = loop_;
+    LivenessGuard::Watcher watcher = liveness_.watch();
+    conn->setCloseCallback([this, loop, watcher](const TcpConnectionPtr& c) {
+        if (watcher.alive()) {
+            removeConnection(c);
+        } else {
+            loop->queueInLoop(std::bind(&TcpConnection::connectDestroyed, c));
+        }
+    });
+    Member member = { conn, HostKey(backend) };
+    connections_.insert(std::make_pair(conn->id(), std::move(member)));
+    conn->connectEstablished();
+
+    Host& host = hostFor(backend);
+    host.failures = 0;
+    host.retryDelayMs = kInitRetryDelayMs;
+    release(host, conn);
+}
+
+void ConnectionPool::connectFailed(const InetAddress& backend) {
+    loop_->assertInLoopThread();
+    Host& host = hostFor(backend);
+    assert(host.total > 0);
+    if (++host.failures < failureThreshold_ && host.total == 1 && !host.waiters.empty()) {
+        // Back off like Connector does. The slot stays counted in total until
+        // the retry fires.
+        RTCLOG(RTC_INFO, "ConnectionPool %s reconnecting to %s in %d ms",
+               name_.c_str(), backend.toIpPort().c_str(), host.retryDelayMs);
+        LivenessGuard::Watcher watcher = liveness_.watch();
+        loop_->runAfter(host.retryDelayMs / 1000.0, [this, watcher, backend]() {
+            if (watcher.alive()) {
+                retryConnect(backend);
+            }
+        });
+        host.retryDelayMs = std::min(host.retryDelayMs * 2, kMaxRetryDelayMs);
+        return;
+    }
+    --host.total;
+    if (host.failures >= failureThreshold_) {
+        RTCLOG(RTC_WARN, "ConnectionPool %s backend %s marked down after %d failures",
+               name_.c_str(), backend.toIpPort().c_str(), host.failures);
+        host.downUntil = std::chrono::steady_clock::now()
+            + std::chrono::milliseconds(static_cast<int64_t>(cooldown_ * 1000));
+        host.failures = 0;
+        host.retryDelayMs = kInitRetryDelayMs;
+        std::deque<CheckoutCallback> waiters;
+        waiters.swap(host.waiters);
+        for (const auto& waiter : waiters) {
+            waiter(TcpConnectionPtr());
+        }
+    }
+}
+
+void ConnectionPool::retryConnect(const InetAddress& backend) {
+    loop_->assertInLoopThread();
+    Host& host = hostFor(backend);
+    assert(host.total > 0);
+    --host.total;
+    // The waiters may have been served by a checkin in the meantime.
+    if (!host.waiters.empty() && host.total < maxPerHost_) {
+        startConnect(host);
+    }
+}
+
+void ConnectionPool::removeConnection(const TcpConnectionPtr& conn) {
+    loop_->assertInLoopThread();
+    loop_->queueInLoop(std::bind(&TcpConnection::connectDestroyed, conn));
+    Member* member = memberOf(conn);
+    if (!member) {
+        return;
+    }
+    auto it = hosts_.find(member->backend);
+    connections_.erase(conn->id());
+    if (it == hosts_.end()) {
+        return;
+    }
+    Host& host = it->second;
+    for (auto idle = host.idle.begin(); idle != host.idle.end(); ++idle) {
+        if (idle->conn == conn) {
+            host.idle.erase(idle);
+            break;
+        }
+    }
+    assert(host.total > 0);
+    --host.total;
+    if (!host.waiters.empty() && host.total < maxPerHost_) {
+        startConnect(host);
+    }
+}
+
+void ConnectionPool::evictIdle() {
+    const Timestamp deadline = std::chrono::steady_clock::now()
+        - std::chrono::milliseconds(static_cast<int64_t>(idleTimeout_ * 1000));
+    for (auto& item : hosts_) {
+        std::vector<IdleEntry>& idle = item.second.idle;
+        size_t expired = 0;
+        while (expired < idle.size() && idle[expired].since < deadline) {
+            ++expired;
+        }
+        if (expired == 0) {
+            continue;
+        }
+        std::vector<IdleEntry> victims(idle.begin(), idle.begin() + expired);
+        idle.erase(idle.begin(), idle.begin() + expired);
+        for (const auto& entry : victims) {
+            entry.conn->forceClose();
+        }
+    }
+}
+
+} // namespace hvnetpp
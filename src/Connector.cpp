@@ -0,0 +1,206 @@
+#include "hvnetpp/Connector.h"
+#include "hvnetpp/Channel.h"
+#include "hvnetpp/EventLoop.h"
+#include "hvnetpp/SocketsOps.h"
+#include "rtclog.h"
+#include <algorithm>
+#include <assert.h>
+#include <cerrno>
+#include <cstring>
+
+namespace hvnetpp {
+
+const int Connector::kMaxRetryDelayMs;
+const int Connector::kInitRetryDelayMs;
+
+Connector::Connector(EventLoop* loop, const InetAddress& serverAddr)
+    : loop_(loop),
+      serverAddr_(serverAddr),
+      connect_(false),
+      state_(kDisconnected),
+      retry_(true),
+      retryDelayMs_(kInitRetryDelayMs) {
+}
+
+Connector::~Connector() {
+    std::shared_ptr<Channel> channel = std::move(channel_);
+    if (channel) {
+        channel->disableAll();
+        channel->remove();
+        sockets::close(channel->fd());
+        loop_->queueInLoop([channel]() {});
+    }
+}
+
+void Connector::start() {
+    connect_ = true;
+    loop_->runInLoop(std::bind(&Connector::startInLoop, shared_from_this()));
+}
+
+void Connector::restart() {
+    loop_->assertInLoopThread();
+    setState(kDisconnected);
+    retryDelayMs_ = kInitRetryDelayMs;
+    connect_ = true;
+    startInLoop();
+}
+
+void Connector::stop() {
+    connect_ = false;
+    loop_->queueInLoop(std::bind(&Connector::stopInLoop, shared_from_this()));
+}
+
+void Connector::startInLoop() {
+    loop_->assertInLoopThread();
+    assert(state_ == kDisconnected);
+    if (connect_) {
+        connect();
+    } else {
+        RTCLOG(RTC_DEBUG, "Connector::startInLoop do not connect");
+    }
+}
+
+void Connector::stopInLoop() {
+    loop_->assertInLoopThread();
+    loop_->cancel(retryTimer_);
+    if (state_ == kConnecting) {
+        setState(kDisconnected);
+        int sockfd = removeAndResetChannel();
+        sockets::close(sockfd);
+    }
+}
+
+void Connector::connect() {
+    if (!serverAddr_.valid()) {
+        RTCLOG(RTC_ERROR, "Connector::connect invalid server address");
+        fail(-1);
+        return;
+    }
+    int sockfd = sockets::createNonblockingOrDie(serverAddr_.family());
+    int ret = sockets::connect(sockfd, serverAddr_.getSockAddr());
+    int savedErrno = (ret == 0) ? 0 : errno;
+    switch (savedErrno) {
+        case 0:
+        case EINPROGRESS:
+        case EINTR:
+        case EISCONN:
+            connecting(sockfd);
+            break;
+
+        case EAGAIN:
+        case EADDRINUSE:
+        case EADDRNOTAVAIL:
+        case ECONNREFUSED:
+        case ENETUNREACH:
+        case ENOENT: // AF_UNIX server not up yet
+            retry(sockfd);
+            break;
+
+        case EACCES:
+        case EPERM:
+        case EAFNOSUPPORT:
+        case EALREADY:
+        case EBADF:
+        case EFAULT:
+        case ENOTSOCK:
+            RTCLOG(RTC_ERROR, "Connector::connect %s error: %s",
+                   serverAddr_.toIpPort().c_str(), strerror(savedErrno));
+            fail(sockfd);
+            break;
+
+        default:
+            RTCLOG(RTC_ERROR, "Connector::connect %s unexpected error: %s",
+                   serverAddr_.toIpPort().c_str(), strerror(savedErrno));
+            fail(sockfd);
+            break;
+    }
+}
+
+// Wait for write readiness, which signals the end of a non-blocking connect.
+void Connector::connecting(int sockfd) {
+    setState(kConnecting);
+    assert(!channel_);
+    channel_ = std::make_shared<Channel>(loop_, sockfd);
+    channel_->tie(liveness_);
+    channel_->setWriteCallback([this]() { handleWrite(); });
+    channel_->setErrorCallback([this]() { handleError(); });
+    channel_->enableWriting();
+}
+
+// We are inside Channel::handleEvent, so the channel must outlive this call.
+int Connector::removeAndResetChannel() {
+    std::shared_ptr<Channel> channel = std::move(channel_);
+    channel->disableAll();
+    channel->remove();
+    loop_->queueInLoop([channel]() {});
+    return channel->fd();
+}
+
+void Connector::handleWrite() {
+    if (state_ != kConnecting) {
+        return;
+    }
+    int sockfd = removeAndResetChannel();
+    int err = sockets::getSocketError(sockfd);
+    if (err) {
+        RTCLOG(RTC_WARN, "Connector::handleWrite %s SO_ERROR = %d %s",
+               serverAddr_.toIpPort().c_str(), err, strerror(err));
+        retry(sockfd);
+    } else if (sockets::isSelfConnect(sockfd)) {
+        RTCLOG(RTC_WARN, "Connector::handleWrite %s self connect", serverAddr_.toIpPort().c_str());
+        retry(sockfd);
+    } else {
+        setState(kConnected);
+        if (connect_ && newConnectionCallback_) {
+            newConnectionCallback_(sockfd);
+        } else {
+            sockets::close(sockfd);
+        }
+    }
+}
+
+void Connector::handleError() {
+    if (state_ != kConnecting) {
+        return;
+    }
+    int sockfd = removeAndResetChannel();
+    int err = sockets::getSocketError(sockfd);
+    RTCLOG(RTC_WARN, "Connector::handleError %s SO_ERROR = %d %s",
+           serverAddr_.toIpPort().c_str(), err, strerror(err));
+    retry(sockfd);
+}
+
+void Connector::retry(int sockfd) {
+    if (!retry_) {
+        fail(sockfd);
+        return;
+    }
+    sockets::close(sockfd);
+    setState(kDisconnected);
+    if (connect_) {
+        RTCLOG(RTC_INFO, "Connector::retry connecting to %s in %d ms",
+               serverAddr_.toIpPort().c_str(), retryDelayMs_);
+        std::weak_ptr<Connector> weakSelf(shared_from_this());
+        retryTimer_ = loop_->runAfter(retryDelayMs_ / 1000.0, [weakSelf]() {
+            ConnectorPtr self = weakSelf.lock();
+            if (self && self->state_ == kDisconnected) {
+                self->startInLoop();
+            }
+        });
+        retryDelayMs_ = std::min(retryDelayMs_ * 2, kMaxRetryDelayMs);
+    } else {
+        RTCLOG(RTC_DEBUG, "Connector::retry do not connect");
+    }
+}
+
+void Connector::fail(int sockfd) {
+    if (sockfd >= 0) {
+        sockets::close(sockfd);
+    }
+    setState(kDisconnected);
+    if (connect_ && connectFailedCallback_) {
+        connectFailedCallback_();
+    }
+}
+
+} // namespace hvnetpp
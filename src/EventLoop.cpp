@@ -53,7 +53,8 @@ EventLoop::EventLoop()
       wakeupFd_(createEventfd()),
       wakeupChannel_(new Channel(this, wakeupFd_)),
       currentActiveChannel_(nullptr),
-      pendingQueue_(new PendingQueue(16))
+      pendingQueue_(new PendingQueue(16)),
+      busyMicroseconds_(0)
 {
     RTCLOG(RTC_DEBUG, "EventLoop created %p in thread %d", this, tid_);
     if (t_loopInThisThread) {
@@ -85,6 +86,7 @@ void EventLoop::loop() {
     while (!quit_) {
         activeChannels_.clear();
         poller_->poll(kPollTimeMs, &activeChannels_);
+        const Timestamp busyStart = std::chrono::steady_clock::now();
         
         eventHandling_ = true;
         for (Channel* channel : activeChannels_) {
@@ -95,6 +97,11 @@ void EventLoop::loop() {
         eventHandling_ = false;
 
         doPendingFunctors();
+
+        const int64_t busy = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - busyStart).count();
+        busyMicroseconds_.store(busyMicroseconds_.load(std::memory_order_relaxed) + busy,
+                                std::memory_order_relaxed);
     }
 
     RTCLOG(RTC_TRACE, "EventLoop %p stop looping", this);
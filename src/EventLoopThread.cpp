@@ -0,0 +1,55 @@
+#include "hvnetpp/EventLoopThread.h"
+#include "hvnetpp/EventLoop.h"
+
+#include <pthread.h>
+
+namespace hvnetpp {
+
+EventLoopThread::EventLoopThread(const ThreadInitCallback& cb, const std::string& name)
+    : loop_(nullptr),
+      callback_(cb),
+      name_(name) {
+}
+
+EventLoopThread::~EventLoopThread() {
+    EventLoop* loop = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        loop = loop_;
+    }
+    if (loop) {
+        // The loop lives on the thread's stack, it is valid until we join.
+        loop->quit();
+    }
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+EventLoop* EventLoopThread::startLoop() {
+    thread_ = std::thread(&EventLoopThread::threadFunc, this);
+    std::unique_lock<std::mutex> lock(mutex_);
+    cond_.wait(lock, [this]() { return loop_ != nullptr; });
+    return loop_;
+}
+
+void EventLoopThread::threadFunc() {
+    if (!name_.empty()) {
+        // Linux truncates thread names to 15 characters.
+        ::pthread_setname_np(::pthread_self(), name_.substr(0, 15).c_str());
+    }
+    EventLoop loop;
+    if (callback_) {
+        callback_(&loop);
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        loop_ = &loop;
+        cond_.notify_one();
+    }
+    loop.loop();
+    std::lock_guard<std::mutex> lock(mutex_);
+    loop_ = nullptr;
+}
+
+} // namespace hvnetpp
@@ -0,0 +1,55 @@
+#include "hvnetpp/EventLoopThreadPool.h"
+#include "hvnetpp/EventLoop.h"
+#include "hvnetpp/EventLoopThread.h"
+
+#include <assert.h>
+
+namespace hvnetpp {
+
+EventLoopThreadPool::EventLoopThreadPool(EventLoop* baseLoop, const std::string& name)
+    : baseLoop_(baseLoop),
+      name_(name),
+      started_(false),
+      numThreads_(0),
+      next_(0) {
+}
+
+EventLoopThreadPool::~EventLoopThreadPool() {
+    // The threads own their loops, nothing else to release.
+}
+
+void EventLoopThreadPool::start(const ThreadInitCallback& cb) {
+    assert(!started_);
+    baseLoop_->assertInLoopThread();
+    started_ = true;
+    for (int i = 0; i < numThreads_; ++i) {
+        std::unique_ptr<EventLoopThread> t(new EventLoopThread(cb, name_ + std::to_string(i)));
+        loops_.push_back(t->startLoop());
+        threads_.push_back(std::move(t));
+    }
+    if (numThreads_ == 0 && cb) {
+        cb(baseLoop_);
+    }
+}
+
+EventLoop* EventLoopThreadPool::getNextLoop() {
+    baseLoop_->assertInLoopThread();
+    assert(started_);
+    if (loops_.empty()) {
+        return baseLoop_;
+    }
+    EventLoop* loop = loops_[next_];
+    next_ = (next_ + 1) % loops_.size();
+    return loop;
+}
+
+std::vector<EventLoop*> EventLoopThreadPool::getAllLoops() {
+    baseLoop_->assertInLoopThread();
+    assert(started_);
+    if (loops_.empty()) {
+        return std::vector<EventLoop*>(1, baseLoop_);
+    }
+    return loops_;
+}
+
+} // namespace hvnetpp
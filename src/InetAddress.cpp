@@ -1,8 +1,10 @@
 #include "hvnetpp/InetAddress.h"
 #include "hvnetpp/SocketsOps.h"
+#include "rtclog.h"
 #include <netdb.h>
 #include <sys/socket.h>
 #include <strings.h>
+#include <algorithm>
 #include <cstring>
 #include <cstddef>
 #include <cassert>
@@ -16,9 +18,10 @@ static const in_addr_t kInaddrLoopback = INADDR_LOOPBACK;
 
 namespace hvnetpp {
 
-static_assert(sizeof(InetAddress) == sizeof(struct sockaddr_in6), "InetAddress is same size as sockaddr_in6");
+static_assert(sizeof(InetAddress) <= sizeof(struct sockaddr_storage), "InetAddress fits in sockaddr_storage");
 static_assert(offsetof(sockaddr_in, sin_family) == 0, "sin_family offset 0");
 static_assert(offsetof(sockaddr_in6, sin6_family) == 0, "sin6_family offset 0");
+static_assert(offsetof(sockaddr_un, sun_family) == 0, "sun_family offset 0");
 static_assert(offsetof(sockaddr_in, sin_port) == 2, "sin_port offset 2");
 static_assert(offsetof(sockaddr_in6, sin6_port) == 2, "sin6_port offset 2");
 
@@ -48,14 +51,38 @@ InetAddress::InetAddress(std::string ip, uint16_t port, bool ipv6) {
     }
 }
 
+InetAddress InetAddress::fromUnixPath(const std::string& path, bool abstractNamespace) {
+    struct sockaddr_un un;
+    bzero(&un, sizeof un);
+    un.sun_family = AF_UNIX;
+    // Leave room for the trailing NUL, or the leading one of an abstract name.
+    const size_t maxLen = sizeof un.sun_path - 1;
+    struct sockaddr_storage storage;
+    bzero(&storage, sizeof storage);
+    if (path.size() > maxLen) {
+        // A truncated name would be a different socket; hand back an
+        // address that bind and connect reject.
+        RTCLOG(RTC_ERROR, "InetAddress::fromUnixPath path too long: %s", path.c_str());
+        storage.ss_family = AF_UNSPEC;
+        return InetAddress(storage);
+    }
+    memcpy(un.sun_path + (abstractNamespace ? 1 : 0), path.data(), path.size());
+    memcpy(&storage, &un, sizeof un);
+    return InetAddress(storage);
+}
+
+socklen_t InetAddress::getSockAddrLen() const {
+    return sockets::sockaddrLength(getSockAddr());
+}
+
 std::string InetAddress::toIpPort() const {
-    char buf[64] = "";
+    char buf[sizeof(addrUn_.sun_path) + 2] = "";
     sockets::toIpPort(buf, sizeof buf, getSockAddr());
     return buf;
 }
 
 std::string InetAddress::toIp() const {
-    char buf[64] = "";
+    char buf[sizeof(addrUn_.sun_path) + 2] = "";
     sockets::toIp(buf, sizeof buf, getSockAddr());
     return buf;
 }
@@ -66,6 +93,9 @@ uint32_t InetAddress::ipNetEndian() const {
 }
 
 uint16_t InetAddress::toPort() const {
+    if (isUnix()) {
+        return 0;
+    }
     return ntohs(portNetEndian());
 }
 
@@ -0,0 +1,135 @@
+#include "hvnetpp/JitterBuffer.h"
+#include "hvnetpp/RtpPacket.h"
+
+#include <cstring>
+
+namespace hvnetpp {
+
+namespace {
+
+size_t roundUpPowerOfTwo(size_t n) {
+    size_t size = 1;
+    while (size < n) {
+        size <<= 1;
+    }
+    return size;
+}
+
+} // namespace
+
+JitterBuffer::JitterBuffer(size_t capacity, size_t maxPacketSize, int64_t maxDelayUs)
+    : maxPacketSize_(maxPacketSize),
+      maxDelayUs_(maxDelayUs),
+      mask_(0),
+      started_(false),
+      nextSeq_(0),
+      size_(0),
+      lost_(0),
+      dropped_(0),
+      late_(0),
+      duplicates_(0) {
+    // Half the sequence space at most, so "ahead" and "behind" stay unambiguous.
+    capacity = roundUpPowerOfTwo(capacity == 0 ? 1 : capacity);
+    if (capacity > 32768) {
+        capacity = 32768;
+    }
+    mask_ = capacity - 1;
+    slots_.resize(capacity);
+    storage_.resize(capacity * maxPacketSize);
+    reset();
+}
+
+void JitterBuffer::reset() {
+    for (Slot& slot : slots_) {
+        slot.used = false;
+    }
+    started_ = false;
+    size_ = 0;
+}
+
+JitterBuffer::InsertResult JitterBuffer::insert(const RtpPacket& packet, int64_t arrivalUs) {
+    if (packet.size() > maxPacketSize_) {
+        return kTooLarge;
+    }
+    const uint16_t seq = packet.sequenceNumber();
+    if (!started_) {
+        started_ = true;
+        nextSeq_ = seq;
+    }
+    const uint16_t ahead = static_cast<uint16_t>(seq - nextSeq_);
+    if (ahead >= 0x8000) {
+        ++late_;
+        return kTooLate;
+    }
+    if (ahead > mask_) {
+        advanceTo(static_cast<uint16_t>(seq - mask_));
+    }
+    const size_t index = seq & mask_;
+    Slot& slot = slots_[index];
+    if (slot.used) {
+        ++duplicates_;
+        return kDuplicate;
+    }
+    ::memcpy(&storage_[index * maxPacketSize_], packet.data(), packet.size());
+    slot.used = true;
+    slot.seq = seq;
+    slot.len = packet.size();
+    slot.arrivalUs = arrivalUs;
+    ++size_;
+    return kInserted;
+}
+
+bool JitterBuffer::next(int64_t nowUs, Entry* entry) {
+    if (size_ == 0) {
+        return false;
+    }
+    Slot& head = slots_[nextSeq_ & mask_];
+    if (head.used) {
+        release(head, entry);
+        return true;
+    }
+    // Gap at the head: find the first held packet behind it.
+    for (size_t gap = 1; gap <= mask_; ++gap) {
+        const uint16_t seq = static_cast<uint16_t>(nextSeq_ + gap);
+        Slot& slot = slots_[seq & mask_];
+        if (slot.used) {
+            if (nowUs - slot.arrivalUs < maxDelayUs_) {
+                return false;
+            }
+            lost_ += gap;
+            nextSeq_ = seq;
+            release(slot, entry);
+            return true;
+        }
+    }
+    return false;
+}
+
+void JitterBuffer::release(Slot& slot, Entry* entry) {
+    entry->data = &storage_[(slot.seq & mask_) * maxPacketSize_];
+    entry->len = slot.len;
+    entry->seq = slot.seq;
+    entry->arrivalUs = slot.arrivalUs;
+    slot.used = false;
+    --size_;
+    nextSeq_ = static_cast<uint16_t>(slot.seq + 1);
+}
+
+void JitterBuffer::advanceTo(uint16_t seq) {
+    const uint16_t shift = static_cast<uint16_t>(seq - nextSeq_);
+    const size_t scan = shift < slots_.size() ? shift : slots_.size();
+    for (size_t i = 0; i < scan; ++i) {
+        Slot& slot = slots_[(nextSeq_ + i) & mask_];
+        if (slot.used) {
+            slot.used = false;
+            --size_;
+            ++dropped_;
+        } else {
+            ++lost_;
+        }
+    }
+    lost_ += shift - scan;
+    nextSeq_ = seq;
+}
+
+} // namespace hvnetpp
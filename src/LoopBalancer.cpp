@@ -0,0 +1,128 @@
+#include "hvnetpp/LoopBalancer.h"
+#include "hvnetpp/EventLoop.h"
+#include "rtclog.h"
+
+namespace hvnetpp {
+
+LoopBalancer::LoopBalancer(EventLoop* loop, const std::vector<EventLoop*>& loops)
+    : loop_(loop),
+      shards_(std::make_shared<ShardList>()),
+      lastBusy_(loops.size(), 0),
+      interval_(1.0),
+      threshold_(0.25),
+      started_(false) {
+    for (EventLoop* l : loops) {
+        std::shared_ptr<Shard> shard = std::make_shared<Shard>();
+        shard->loop = l;
+        shards_->push_back(shard);
+    }
+}
+
+LoopBalancer::~LoopBalancer() {
+    loop_->assertInLoopThread();
+    stop();
+}
+
+void LoopBalancer::start() {
+    loop_->assertInLoopThread();
+    if (started_) {
+        return;
+    }
+    started_ = true;
+    for (size_t i = 0; i < shards_->size(); ++i) {
+        lastBusy_[i] = (*shards_)[i]->loop->busyMicroseconds();
+    }
+    timer_ = loop_->runEvery(interval_, std::bind(&LoopBalancer::balance, this));
+}
+
+void LoopBalancer::stop() {
+    loop_->assertInLoopThread();
+    if (started_) {
+        loop_->cancel(timer_);
+        started_ = false;
+    }
+}
+
+void LoopBalancer::track(const TcpConnectionPtr& conn) {
+    EventLoop* connLoop = conn->getLoop();
+    for (const std::shared_ptr<Shard>& shard : *shards_) {
+        if (shard->loop == connLoop) {
+            Entry entry = { conn, 0 };
+            connLoop->runInLoop(std::bind(&LoopBalancer::addInLoop, shard, entry));
+            return;
+        }
+    }
+}
+
+void LoopBalancer::addInLoop(const std::shared_ptr<Shard>& shard, const Entry& entry) {
+    shard->entries.push_back(entry);
+}
+
+void LoopBalancer::balance() {
+    loop_->assertInLoopThread();
+    const ShardList& shards = *shards_;
+    if (shards.size() < 2) {
+        return;
+    }
+    size_t hottest = 0;
+    size_t idlest = 0;
+    std::vector<int64_t> load(shards.size());
+    for (size_t i = 0; i < shards.size(); ++i) {
+        const int64_t busy = shards[i]->loop->busyMicroseconds();
+        load[i] = busy - lastBusy_[i];
+        lastBusy_[i] = busy;
+        if (load[i] > load[hottest]) {
+            hottest = i;
+        }
+        if (load[i] < load[idlest]) {
+            idlest = i;
+        }
+    }
+    const double gap = static_cast<double>(load[hottest] - load[idlest]) / (interval_ * 1e6);
+    if (gap > threshold_) {
+        shards[hottest]->loop->queueInLoop(std::bind(&LoopBalancer::moveHottest, shards_, hottest, idlest));
+    }
+}
+
+// Runs on the busy loop. A loop with a single connection is left alone,
+// moving it would only move the hotspot.
+void LoopBalancer::moveHottest(const std::shared_ptr<ShardList>& shards, size_t from, size_t to) {
+    Shard& shard = *(*shards)[from];
+    std::vector<Entry>& entries = shard.entries;
+    size_t best = entries.size();
+    uint64_t bestDelta = 0;
+    size_t live = 0;
+    for (size_t i = 0; i < entries.size();) {
+        TcpConnectionPtr conn = entries[i].conn.lock();
+        if (!conn || !conn->connected() || conn->getLoop() != shard.loop) {
+            // Closed, or migrated by someone else.
+            entries[i] = entries.back();
+            entries.pop_back();
+            continue;
+        }
+        ++live;
+        const uint64_t bytes = conn->bytesReceived() + conn->bytesSent();
+        const uint64_t delta = bytes - entries[i].lastBytes;
+        entries[i].lastBytes = bytes;
+        if (delta > bestDelta) {
+            bestDelta = delta;
+            best = i;
+        }
+        ++i;
+    }
+    if (live < 2 || best == entries.size()) {
+        return;
+    }
+    Entry entry = entries[best];
+    entries[best] = entries.back();
+    entries.pop_back();
+
+    TcpConnectionPtr conn = entry.conn.lock();
+    const std::shared_ptr<Shard>& target = (*shards)[to];
+    RTCLOG(RTC_INFO, "LoopBalancer moves %s, %llu bytes since last round",
+           conn->name().c_str(), static_cast<unsigned long long>(bestDelta));
+    conn->migrateTo(target->loop);
+    target->loop->queueInLoop(std::bind(&LoopBalancer::addInLoop, target, entry));
+}
+
+} // namespace hvnetpp
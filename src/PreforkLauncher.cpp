@@ -0,0 +1,225 @@
+#include "hvnetpp/PreforkLauncher.h"
+#include "hvnetpp/EventLoop.h"
+#include "hvnetpp/SocketsOps.h"
+#include "rtclog.h"
+
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace hvnetpp {
+
+namespace {
+
+// One fixed-size record per report, below PIPE_BUF so concurrent writers
+// never interleave.
+struct StatsRecord {
+    int32_t index;
+    int32_t pid;
+    PreforkLauncher::Stats stats;
+};
+
+// A worker that dies this soon after starting is respawned only after a
+// delay, so a crash on startup doesn't turn into a fork loop.
+const int64_t kMinWorkerLifetimeMs = 1000;
+const int64_t kRespawnDelayMs = 1000;
+const int kPollIntervalMs = 100;
+
+int64_t nowMs() {
+    using namespace std::chrono;
+    return duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+} // namespace
+
+PreforkLauncher::PreforkLauncher(const InetAddress& listenAddr, int numWorkers)
+    : listenAddr_(listenAddr),
+      boundAddr_(listenAddr),
+      numWorkers_(numWorkers > 0 ? numWorkers : 1),
+      statsInterval_(1.0),
+      quit_(false),
+      reserveFd_(-1),
+      workers_(numWorkers_) {
+    statsPipe_[0] = statsPipe_[1] = -1;
+}
+
+PreforkLauncher::~PreforkLauncher() {
+    stopWorkers();
+    if (reserveFd_ >= 0) {
+        ::close(reserveFd_);
+    }
+    for (int fd : statsPipe_) {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+}
+
+int PreforkLauncher::run() {
+    // Each worker's Acceptor would unlink the socket file the others listen on.
+    if (listenAddr_.family() != AF_INET && listenAddr_.family() != AF_INET6) {
+        RTCLOG(RTC_ERROR, "PreforkLauncher::run %s: only IPv4 and IPv6 can be shared",
+               listenAddr_.toIpPort().c_str());
+        return -1;
+    }
+    reserveFd_ = ::socket(listenAddr_.family(), SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (reserveFd_ < 0) {
+        RTCLOG(RTC_ERROR, "PreforkLauncher::run socket error: %s", strerror(errno));
+        return -1;
+    }
+    sockets::setReuseAddr(reserveFd_, true);
+    sockets::setReusePort(reserveFd_, true);
+    if (::bind(reserveFd_, listenAddr_.getSockAddr(), sockets::sockaddrLength(listenAddr_.getSockAddr())) != 0) {
+        RTCLOG(RTC_ERROR, "PreforkLauncher::run bind %s error: %s",
+               listenAddr_.toIpPort().c_str(), strerror(errno));
+        return -1;
+    }
+    // Port 0 picks a port here; workers must join that one.
+    boundAddr_ = InetAddress(sockets::getLocalAddr(reserveFd_));
+    if (::pipe2(statsPipe_, O_CLOEXEC | O_NONBLOCK) != 0) {
+        RTCLOG(RTC_ERROR, "PreforkLauncher::run pipe error: %s", strerror(errno));
+        return -1;
+    }
+
+    int64_t nextReportMs = nowMs() + static_cast<int64_t>(statsInterval_ * 1000);
+    while (!quit_) {
+        const int64_t now = nowMs();
+        reapWorkers(now);
+        spawnWorkers(now);
+
+        struct pollfd pfd = { statsPipe_[0], POLLIN, 0 };
+        int n = ::poll(&pfd, 1, kPollIntervalMs);
+        if (n > 0) {
+            readStats();
+        }
+        if (nowMs() >= nextReportMs) {
+            nextReportMs += static_cast<int64_t>(statsInterval_ * 1000);
+            if (statsCallback_) {
+                statsCallback_(totalStats());
+            }
+        }
+    }
+    stopWorkers();
+    return 0;
+}
+
+void PreforkLauncher::spawnWorkers(int64_t now) {
+    for (int i = 0; i < numWorkers_; ++i) {
+        WorkerSlot& slot = workers_[i];
+        if (slot.pid > 0 || now < slot.respawnAtMs) {
+            continue;
+        }
+        pid_t pid = ::fork();
+        if (pid == 0) {
+            runWorker(i);
+            ::_exit(0);
+        } else if (pid < 0) {
+            RTCLOG(RTC_ERROR, "PreforkLauncher fork error: %s", strerror(errno));
+            slot.respawnAtMs = now + kRespawnDelayMs;
+            continue;
+        }
+        RTCLOG(RTC_INFO, "PreforkLauncher worker %d started, pid %d", i, pid);
+        slot.pid = pid;
+        slot.startedMs = now;
+        slot.stats = Stats();
+    }
+}
+
+void PreforkLauncher::runWorker(int index) {
+    ::prctl(PR_SET_PDEATHSIG, SIGTERM);
+    if (::getppid() == 1) {
+        ::_exit(0); // parent already gone
+    }
+    ::close(reserveFd_);
+    ::close(statsPipe_[0]);
+    const int statsFd = statsPipe_[1];
+
+    EventLoop loop;
+    Worker worker(&loop, index, boundAddr_);
+    if (workerInitCallback_) {
+        workerInitCallback_(&worker);
+    }
+    loop.runEvery(statsInterval_, [&worker, statsFd, index]() {
+        StatsRecord record;
+        record.index = index;
+        record.pid = ::getpid();
+        if (worker.sampler_) {
+            record.stats = worker.sampler_();
+        }
+        ssize_t n = ::write(statsFd, &record, sizeof record);
+        (void)n; // a full pipe just drops this sample
+    });
+    loop.loop();
+}
+
+// Waits on our workers only; other children of the process are not ours to reap.
+void PreforkLauncher::reapWorkers(int64_t now) {
+    for (int i = 0; i < numWorkers_; ++i) {
+        WorkerSlot& slot = workers_[i];
+        if (slot.pid <= 0) {
+            continue;
+        }
+        int status = 0;
+        if (::waitpid(slot.pid, &status, WNOHANG) != slot.pid) {
+            continue;
+        }
+        RTCLOG(RTC_WARN, "PreforkLauncher worker %d pid %d exited, status %d", i, slot.pid, status);
+        slot.pid = -1;
+        slot.stats = Stats();
+        slot.respawnAtMs = now - slot.startedMs < kMinWorkerLifetimeMs ? now + kRespawnDelayMs : now;
+    }
+}
+
+void PreforkLauncher::readStats() {
+    StatsRecord records[64];
+    ssize_t n;
+    while ((n = ::read(statsPipe_[0], records, sizeof records)) > 0) {
+        const size_t count = static_cast<size_t>(n) / sizeof(StatsRecord);
+        for (size_t i = 0; i < count; ++i) {
+            const StatsRecord& record = records[i];
+            if (record.index < 0 || record.index >= numWorkers_) {
+                continue;
+            }
+            WorkerSlot& slot = workers_[record.index];
+            // Ignore late reports from a worker that has been replaced.
+            if (slot.pid == record.pid) {
+                slot.stats = record.stats;
+            }
+        }
+    }
+}
+
+void PreforkLauncher::stopWorkers() {
+    for (WorkerSlot& slot : workers_) {
+        if (slot.pid > 0) {
+            ::kill(slot.pid, SIGTERM);
+        }
+    }
+    for (WorkerSlot& slot : workers_) {
+        if (slot.pid > 0) {
+            int status = 0;
+            ::waitpid(slot.pid, &status, 0);
+            slot.pid = -1;
+            slot.stats = Stats();
+        }
+    }
+}
+
+PreforkLauncher::Stats PreforkLauncher::totalStats() const {
+    Stats total;
+    for (const WorkerSlot& slot : workers_) {
+        total.connections += slot.stats.connections;
+        total.accepted += slot.stats.accepted;
+        total.bytesRead += slot.stats.bytesRead;
+        total.bytesWritten += slot.stats.bytesWritten;
+    }
+    return total;
+}
+
+} // namespace hvnetpp
@@ -0,0 +1,172 @@
+#include "hvnetpp/RetransmissionCache.h"
+#include "hvnetpp/EventLoop.h"
+#include "hvnetpp/UdpSocket.h"
+
+#include <cstring>
+
+namespace hvnetpp {
+
+namespace {
+
+const size_t kRtpHeaderSize = 12;
+const uint8_t kRtcpRtpfb = 205;
+const uint8_t kNackFormat = 1;
+
+size_t roundUpPowerOfTwo(size_t n) {
+    size_t size = 1;
+    while (size < n) {
+        size <<= 1;
+    }
+    return size;
+}
+
+} // namespace
+
+RetransmissionCache::RetransmissionCache(EventLoop* loop, const Config& config)
+    : loop_(loop),
+      window_(config.windowMs),
+      maxPacketSize_(config.maxPacketSize),
+      mask_(0),
+      fifoHead_(0),
+      fifoSize_(0),
+      writePos_(0),
+      haveSsrc_(false),
+      ssrc_(0),
+      stats_{0, 0, 0} {
+    size_t slots = roundUpPowerOfTwo(config.slots == 0 ? 1 : config.slots);
+    if (slots > 32768) {
+        slots = 32768;
+    }
+    mask_ = slots - 1;
+    slots_.resize(slots);
+    for (Slot& slot : slots_) {
+        slot.valid = false;
+    }
+    fifo_.resize(slots);
+    // One extra packet so a full window always fits next to the one being written.
+    slab_.resize(config.bitrateBps / 8 * config.windowMs / 1000 + maxPacketSize_);
+
+    // Expire a few times per window; lookup() checks the age as well.
+    const double interval = config.windowMs / 4000.0;
+    expireTimer_ = loop_->runEvery(interval > 0 ? interval : 0.001, [this]() { expire(); });
+}
+
+RetransmissionCache::~RetransmissionCache() {
+    loop_->assertInLoopThread();
+    loop_->cancel(expireTimer_);
+}
+
+void RetransmissionCache::popOldest() {
+    const Record& record = fifo_[fifoHead_];
+    Slot& slot = slots_[record.seq & mask_];
+    if (slot.valid && slot.seq == record.seq && slot.offset == record.offset) {
+        slot.valid = false;
+    }
+    fifoHead_ = (fifoHead_ + 1) & mask_;
+    --fifoSize_;
+}
+
+void RetransmissionCache::store(const char* data, size_t len) {
+    if (len < kRtpHeaderSize || len > maxPacketSize_) {
+        return;
+    }
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+    const uint16_t seq = rtp::readBe16(bytes + 2);
+    ssrc_ = rtp::readBe32(bytes + 8);
+    haveSsrc_ = true;
+
+    size_t pos = writePos_;
+    if (pos + len > slab_.size()) {
+        // Wrap; whatever still sits in the tail is the oldest data.
+        while (fifoSize_ > 0 && fifo_[fifoHead_].offset >= pos) {
+            popOldest();
+        }
+        pos = 0;
+    }
+    while (fifoSize_ > 0) {
+        const Record& oldest = fifo_[fifoHead_];
+        const bool overlaps = oldest.offset < pos + len && oldest.offset + oldest.len > pos;
+        if (!overlaps && fifoSize_ < fifo_.size()) {
+            break;
+        }
+        popOldest();
+    }
+
+    memcpy(&slab_[pos], data, len);
+    Slot& slot = slots_[seq & mask_];
+    slot.valid = true;
+    slot.seq = seq;
+    slot.offset = static_cast<uint32_t>(pos);
+    slot.len = static_cast<uint32_t>(len);
+    slot.sent = std::chrono::steady_clock::now();
+    Record& record = fifo_[(fifoHead_ + fifoSize_) & mask_];
+    record.seq = seq;
+    record.offset = slot.offset;
+    record.len = slot.len;
+    ++fifoSize_;
+    writePos_ = pos + len;
+    ++stats_.stored;
+}
+
+bool RetransmissionCache::lookup(uint16_t seq, const char** data, size_t* len) {
+    const Slot& slot = slots_[seq & mask_];
+    if (!slot.valid || slot.seq != seq
+        || std::chrono::steady_clock::now() - slot.sent > window_) {
+        ++stats_.misses;
+        return false;
+    }
+    ++stats_.hits;
+    *data = &slab_[slot.offset];
+    *len = slot.len;
+    return true;
+}
+
+ssize_t RetransmissionCache::resend(uint16_t seq, UdpSocket* socket, const InetAddress& dest) {
+    const char* data;
+    size_t len;
+    if (!lookup(seq, &data, &len)) {
+        return -1;
+    }
+    return socket->sendTo(data, len, dest);
+}
+
+size_t RetransmissionCache::onNack(const RtcpReader::Block& block, UdpSocket* socket,
+                                   const InetAddress& dest) {
+    // Header, sender SSRC, media SSRC, then PID/BLP pairs.
+    if (block.type != kRtcpRtpfb || block.count != kNackFormat || block.len < 12) {
+        return 0;
+    }
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(block.data);
+    if (!haveSsrc_ || rtp::readBe32(p + 8) != ssrc_) {
+        return 0;
+    }
+    size_t resent = 0;
+    for (size_t offset = 12; offset + 4 <= block.len; offset += 4) {
+        const uint16_t pid = rtp::readBe16(p + offset);
+        const uint16_t blp = rtp::readBe16(p + offset + 2);
+        if (resend(pid, socket, dest) >= 0) {
+            ++resent;
+        }
+        for (int bit = 0; bit < 16; ++bit) {
+            if ((blp & (1 << bit)) && resend(static_cast<uint16_t>(pid + bit + 1), socket, dest) >= 0) {
+                ++resent;
+            }
+        }
+    }
+    return resent;
+}
+
+void RetransmissionCache::expire() {
+    const Timestamp deadline = std::chrono::steady_clock::now() - window_;
+    while (fifoSize_ > 0) {
+        const Record& oldest = fifo_[fifoHead_];
+        const Slot& slot = slots_[oldest.seq & mask_];
+        const bool live = slot.valid && slot.seq == oldest.seq && slot.offset == oldest.offset;
+        if (live && slot.sent > deadline) {
+            break;
+        }
+        popOldest();
+    }
+}
+
+} // namespace hvnetpp
@@ -0,0 +1,269 @@
+#include "hvnetpp/RtpForwarder.h"
+#include "hvnetpp/EventLoop.h"
+#include "hvnetpp/RtpPacket.h"
+#include "hvnetpp/UdpServer.h"
+#include "hvnetpp/UdpSocket.h"
+#include "rtclog.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+namespace hvnetpp {
+
+namespace {
+
+const size_t kRtpHeaderSize = 12;
+// Copies per sendmmsg() call; the kernel caps vlen at UIO_MAXIOV.
+const size_t kMaxSendBatch = 256;
+// Hand-over ring of a shard fed from another thread.
+const uint32_t kRingSlots = 256;
+const size_t kSlotSize = 1500;
+
+} // namespace
+
+struct RtpForwarder::Shard {
+    struct Subscriber {
+        uint64_t id;
+        InetAddress dest;
+        socklen_t destLen;
+        RtpForwarder::Rewrite rewrite;
+        bool started;
+        uint16_t seqDelta;
+        uint32_t timestampDelta;
+    };
+
+    Shard(UdpSocket* socket, EventLoop* loop)
+        : socket(socket), loop(loop), count(0), forwarded(0), dropped(0),
+          slab(kRingSlots * kSlotSize), lengths(kRingSlots), ringHead(0), ringTail(0), drainPending(false),
+          msgs(kMaxSendBatch), iovecs(2 * kMaxSendBatch), headers(kMaxSendBatch * kRtpHeaderSize) {
+        memset(msgs.data(), 0, msgs.size() * sizeof msgs[0]);
+    }
+
+    void add(const Subscriber& sub) {
+        index[sub.id] = subscribers.size();
+        subscribers.push_back(sub);
+    }
+
+    bool remove(uint64_t id) {
+        auto it = index.find(id);
+        if (it == index.end()) {
+            return false;
+        }
+        const size_t pos = it->second;
+        index.erase(it);
+        if (pos != subscribers.size() - 1) {
+            subscribers[pos] = subscribers.back();
+            index[subscribers[pos].id] = pos;
+        }
+        subscribers.pop_back();
+        return true;
+    }
+
+    // Producer side; false if the ring is full or the packet too big.
+    bool push(const char* data, size_t len) {
+        const uint32_t tail = ringTail.load(std::memory_order_relaxed);
+        if (len > kSlotSize || tail - ringHead.load(std::memory_order_acquire) == kRingSlots) {
+            return false;
+        }
+        const size_t slot = tail % kRingSlots;
+        memcpy(&slab[slot * kSlotSize], data, len);
+        lengths[slot] = static_cast<uint32_t>(len);
+        ringTail.store(tail + 1);
+        return true;
+    }
+
+    void drain();
+    void fanOut(const char* data, size_t len);
+
+    UdpSocket* const socket;
+    EventLoop* const loop;
+    std::atomic<size_t> count; // subscribers, including pending adds
+    std::atomic<uint64_t> forwarded;
+    std::atomic<uint64_t> dropped;
+
+    // Single-producer ring, drained in the loop thread. drainPending is set
+    // while a drain() is queued, so the loop is woken once per batch.
+    std::vector<char> slab;
+    std::vector<uint32_t> lengths;
+    std::atomic<uint32_t> ringHead;
+    std::atomic<uint32_t> ringTail;
+    std::atomic<bool> drainPending;
+
+    // Loop thread only.
+    std::vector<Subscriber> subscribers;
+    std::unordered_map<uint64_t, size_t> index;
+    std::vector<struct mmsghdr> msgs;
+    std::vector<struct iovec> iovecs;
+    std::vector<char> headers; // per-copy patched header scratch
+};
+
+void RtpForwarder::Shard::drain() {
+    // Cleared before tail is read: a push the snapshot misses sees false
+    // and queues the next drain.
+    drainPending.store(false);
+    uint32_t head = ringHead.load(std::memory_order_relaxed);
+    const uint32_t tail = ringTail.load();
+    while (head != tail) {
+        const size_t slot = head % kRingSlots;
+        fanOut(&slab[slot * kSlotSize], lengths[slot]);
+        ringHead.store(++head, std::memory_order_release);
+    }
+}
+
+void RtpForwarder::Shard::fanOut(const char* data, size_t len) {
+    const uint16_t seq = rtp::readBe16(reinterpret_cast<const uint8_t*>(data) + 2);
+    const uint32_t timestamp = rtp::readBe32(reinterpret_cast<const uint8_t*>(data) + 4);
+    size_t next = 0;
+    while (next < subscribers.size()) {
+        const size_t batch = std::min(subscribers.size() - next, kMaxSendBatch);
+        for (size_t i = 0; i < batch; ++i) {
+            Subscriber& sub = subscribers[next + i];
+            if (!sub.started) {
+                sub.started = true;
+                sub.seqDelta = static_cast<uint16_t>(sub.rewrite.firstSeq - seq);
+                sub.timestampDelta = sub.rewrite.firstTimestamp - timestamp;
+            }
+            uint8_t* header = reinterpret_cast<uint8_t*>(&headers[i * kRtpHeaderSize]);
+            memcpy(header, data, kRtpHeaderSize);
+            rtp::writeBe16(header + 2, static_cast<uint16_t>(seq + sub.seqDelta));
+            rtp::writeBe32(header + 4, timestamp + sub.timestampDelta);
+            rtp::writeBe32(header + 8, sub.rewrite.ssrc);
+
+            struct iovec* iov = &iovecs[2 * i];
+            iov[0].iov_base = header;
+            iov[0].iov_len = kRtpHeaderSize;
+            iov[1].iov_base = const_cast<char*>(data + kRtpHeaderSize);
+            iov[1].iov_len = len - kRtpHeaderSize;
+            struct msghdr& hdr = msgs[i].msg_hdr;
+            hdr.msg_name = const_cast<struct sockaddr*>(sub.dest.getSockAddr());
+            hdr.msg_namelen = sub.destLen;
+            hdr.msg_iov = iov;
+            hdr.msg_iovlen = 2;
+        }
+
+        size_t sent = 0;
+        while (sent < batch) {
+            int n = ::sendmmsg(socket->fd(), &msgs[sent], static_cast<unsigned int>(batch - sent), 0);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    // Stale media is worthless; drop the rest of this batch.
+                    dropped.fetch_add(batch - sent, std::memory_order_relaxed);
+                    break;
+                }
+                RTCLOG(RTC_WARN, "RtpForwarder::fanOut() to %s: %s",
+                       subscribers[next + sent].dest.toIpPort().c_str(), strerror(errno));
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                ++sent;
+                continue;
+            }
+            forwarded.fetch_add(n, std::memory_order_relaxed);
+            sent += n;
+        }
+        next += batch;
+    }
+}
+
+RtpForwarder::RtpForwarder(UdpSocket* socket, EventLoop* loop)
+    : nextId_(0) {
+    addShard(socket, loop);
+}
+
+RtpForwarder::RtpForwarder(UdpServer* server)
+    : nextId_(0) {
+    for (size_t i = 0; i < server->numSockets(); ++i) {
+        addShard(server->socket(i), server->socketLoop(i));
+    }
+}
+
+RtpForwarder::~RtpForwarder() = default;
+
+void RtpForwarder::addShard(UdpSocket* socket, EventLoop* loop) {
+    shards_.push_back(std::make_shared<Shard>(socket, loop));
+}
+
+uint64_t RtpForwarder::addSubscriber(const InetAddress& dest, const Rewrite& rewrite) {
+    size_t target = 0;
+    for (size_t i = 1; i < shards_.size(); ++i) {
+        if (shards_[i]->count.load(std::memory_order_relaxed)
+            < shards_[target]->count.load(std::memory_order_relaxed)) {
+            target = i;
+        }
+    }
+    // The shard is encoded in the id, so removal needs no shared lookup.
+    const uint64_t id = nextId_.fetch_add(1) * shards_.size() + target;
+    Shard::Subscriber sub;
+    sub.id = id;
+    sub.dest = dest;
+    sub.destLen = dest.getSockAddrLen();
+    sub.rewrite = rewrite;
+    sub.started = false;
+    sub.seqDelta = 0;
+    sub.timestampDelta = 0;
+
+    std::shared_ptr<Shard> shard = shards_[target];
+    shard->count.fetch_add(1, std::memory_order_relaxed);
+    shard->loop->runInLoop([shard, sub]() { shard->add(sub); });
+    return id;
+}
+
+void RtpForwarder::removeSubscriber(uint64_t id) {
+    std::shared_ptr<Shard> shard = shards_[id % shards_.size()];
+    shard->loop->runInLoop([shard, id]() {
+        if (shard->remove(id)) {
+            shard->count.fetch_sub(1, std::memory_order_relaxed);
+        }
+    });
+}
+
+size_t RtpForwarder::subscriberCount() const {
+    size_t count = 0;
+    for (const auto& shard : shards_) {
+        count += shard->count.load(std::memory_order_relaxed);
+    }
+    return count;
+}
+
+bool RtpForwarder::forward(const char* data, size_t len) {
+    RtpPacket packet;
+    if (!packet.parse(data, len)) {
+        return false;
+    }
+    Shard* local = nullptr;
+    for (const auto& shard : shards_) {
+        const size_t count = shard->count.load(std::memory_order_relaxed);
+        if (count == 0) {
+            continue;
+        }
+        if (shard->loop->isInLoopThread()) {
+            local = shard.get();
+            continue;
+        }
+        if (!shard->push(data, len)) {
+            shard->dropped.fetch_add(count, std::memory_order_relaxed);
+            continue;
+        }
+        if (!shard->drainPending.exchange(true)) {
+            std::shared_ptr<Shard> target = shard;
+            target->loop->queueInLoop([target]() { target->drain(); });
+        }
+    }
+    if (local) {
+        local->fanOut(data, len);
+    }
+    return true;
+}
+
+RtpForwarder::Stats RtpForwarder::stats() const {
+    Stats stats = {0, 0};
+    for (const auto& shard : shards_) {
+        stats.forwarded += shard->forwarded.load(std::memory_order_relaxed);
+        stats.dropped += shard->dropped.load(std::memory_order_relaxed);
+    }
+    return stats;
+}
+
+} // namespace hvnetpp
@@ -0,0 +1,195 @@
+#include "hvnetpp/RtpPacket.h"
+
+namespace hvnetpp {
+
+namespace {
+
+const size_t kRtpHeaderSize = 12;
+const size_t kRtcpHeaderSize = 4;
+const size_t kReportBlockSize = 24;
+const uint8_t kRtcpSr = 200;
+const uint8_t kRtcpRr = 201;
+
+} // namespace
+
+bool RtpPacket::parse(const char* data, size_t len) {
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(data);
+    if (len < kRtpHeaderSize || (p[0] >> 6) != 2) {
+        return false;
+    }
+    size_t offset = kRtpHeaderSize + 4 * (p[0] & 0x0f);
+    size_t extensionOffset = 0;
+    size_t extensionSize = 0;
+    if (p[0] & 0x10) {
+        if (len < offset + 4) {
+            return false;
+        }
+        extensionSize = 4 * static_cast<size_t>(rtp::readBe16(p + offset + 2));
+        extensionOffset = offset + 4;
+        offset = extensionOffset + extensionSize;
+    }
+    size_t padding = 0;
+    if (p[0] & 0x20) {
+        padding = p[len - 1];
+        if (padding == 0) {
+            return false;
+        }
+    }
+    if (len < offset + padding) {
+        return false;
+    }
+    data_ = data;
+    size_ = len;
+    payloadOffset_ = offset;
+    payloadSize_ = len - offset - padding;
+    extensionOffset_ = extensionOffset;
+    extensionSize_ = extensionSize;
+    return true;
+}
+
+bool RtpPacket::findExtension(uint8_t id, const char** value, size_t* len) const {
+    if (!hasExtension()) {
+        return false;
+    }
+    const uint16_t profile = extensionProfile();
+    const uint8_t* p = bytes() + extensionOffset_;
+    const uint8_t* end = p + extensionSize_;
+    if (profile == 0xBEDE) {
+        while (p < end) {
+            if (*p == 0) { // padding
+                ++p;
+                continue;
+            }
+            const uint8_t extId = *p >> 4;
+            const size_t extLen = (*p & 0x0f) + 1;
+            if (extId == 15 || p + 1 + extLen > end) {
+                break;
+            }
+            if (extId == id) {
+                *value = reinterpret_cast<const char*>(p + 1);
+                *len = extLen;
+                return true;
+            }
+            p += 1 + extLen;
+        }
+    } else if ((profile & 0xfff0) == 0x1000) {
+        while (p < end) {
+            if (*p == 0) {
+                ++p;
+                continue;
+            }
+            if (p + 2 > end) {
+                break;
+            }
+            const uint8_t extId = p[0];
+            const size_t extLen = p[1];
+            if (p + 2 + extLen > end) {
+                break;
+            }
+            if (extId == id) {
+                *value = reinterpret_cast<const char*>(p + 2);
+                *len = extLen;
+                return true;
+            }
+            p += 2 + extLen;
+        }
+    }
+    return false;
+}
+
+bool RtcpReader::next(Block* block) {
+    if (offset_ + kRtcpHeaderSize > len_) {
+        return false;
+    }
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(data_ + offset_);
+    if ((p[0] >> 6) != 2) {
+        return false;
+    }
+    const size_t size = 4 * (static_cast<size_t>(rtp::readBe16(p + 2)) + 1);
+    if (offset_ + size > len_) {
+        return false;
+    }
+    block->type = p[1];
+    block->count = p[0] & 0x1f;
+    block->data = data_ + offset_;
+    block->len = size;
+    offset_ += size;
+    return true;
+}
+
+namespace rtcp {
+
+bool parseSenderInfo(const RtcpReader::Block& block, RtcpSenderInfo* info) {
+    if (block.type != kRtcpSr || block.len < kRtcpHeaderSize + 24) {
+        return false;
+    }
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(block.data) + kRtcpHeaderSize;
+    info->ssrc = rtp::readBe32(p);
+    info->ntpTimestamp = (static_cast<uint64_t>(rtp::readBe32(p + 4)) << 32) | rtp::readBe32(p + 8);
+    info->rtpTimestamp = rtp::readBe32(p + 12);
+    info->packetCount = rtp::readBe32(p + 16);
+    info->octetCount = rtp::readBe32(p + 20);
+    return true;
+}
+
+size_t parseReportBlocks(const RtcpReader::Block& block, RtcpReportBlock* blocks, size_t maxBlocks) {
+    size_t offset;
+    if (block.type == kRtcpSr) {
+        offset = kRtcpHeaderSize + 24;
+    } else if (block.type == kRtcpRr) {
+        offset = kRtcpHeaderSize + 4;
+    } else {
+        return 0;
+    }
+    size_t n = 0;
+    for (; n < block.count && n < maxBlocks && offset + kReportBlockSize <= block.len; ++n) {
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(block.data) + offset;
+        RtcpReportBlock& rb = blocks[n];
+        rb.ssrc = rtp::readBe32(p);
+        rb.fractionLost = p[4];
+        int32_t lost = static_cast<int32_t>((p[5] << 16) | (p[6] << 8) | p[7]);
+        if (lost & 0x800000) {
+            lost -= 0x1000000; // sign-extend 24 bits
+        }
+        rb.cumulativeLost = lost;
+        rb.extendedHighestSeq = rtp::readBe32(p + 8);
+        rb.jitter = rtp::readBe32(p + 12);
+        rb.lastSr = rtp::readBe32(p + 16);
+        rb.delaySinceLastSr = rtp::readBe32(p + 20);
+        offset += kReportBlockSize;
+    }
+    return n;
+}
+
+size_t writeReceiverReport(uint32_t senderSsrc, const RtcpReportBlock* blocks, size_t count,
+                           char* out, size_t capacity) {
+    if (count > 31) {
+        count = 31;
+    }
+    const size_t size = kRtcpHeaderSize + 4 + count * kReportBlockSize;
+    if (capacity < size) {
+        return 0;
+    }
+    uint8_t* p = reinterpret_cast<uint8_t*>(out);
+    p[0] = static_cast<uint8_t>(0x80 | count);
+    p[1] = kRtcpRr;
+    rtp::writeBe16(p + 2, static_cast<uint16_t>(size / 4 - 1));
+    rtp::writeBe32(p + 4, senderSsrc);
+    p += 8;
+    for (size_t i = 0; i < count; ++i) {
+        const RtcpReportBlock& rb = blocks[i];
+        rtp::writeBe32(p, rb.ssrc);
+        const uint32_t lost = static_cast<uint32_t>(rb.cumulativeLost) & 0xffffff;
+        rtp::writeBe32(p + 4, (static_cast<uint32_t>(rb.fractionLost) << 24) | lost);
+        rtp::writeBe32(p + 8, rb.extendedHighestSeq);
+        rtp::writeBe32(p + 12, rb.jitter);
+        rtp::writeBe32(p + 16, rb.lastSr);
+        rtp::writeBe32(p + 20, rb.delaySinceLastSr);
+        p += kReportBlockSize;
+    }
+    return size;
+}
+
+} // namespace rtcp
+
+} // namespace hvnetpp
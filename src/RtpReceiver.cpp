@@ -0,0 +1,198 @@
+#include "hvnetpp/RtpReceiver.h"
+#include "rtclog.h"
+
+namespace hvnetpp {
+
+namespace {
+
+const int kMaxDropout = 3000;
+const int kMaxMisorder = 100;
+const int kMinSequential = 2;
+const uint32_t kSeqMod = 1 << 16;
+const uint8_t kRtcpSr = 200;
+const uint8_t kRtcpRr = 201;
+const size_t kMaxReportBlocks = 31;
+
+} // namespace
+
+RtpReceiveStats::RtpReceiveStats(uint32_t clockRate)
+    : clockRate_(clockRate),
+      maxSeq_(0),
+      cycles_(0),
+      baseSeq_(0),
+      badSeq_(kSeqMod + 1),
+      probation_(kMinSequential),
+      received_(0),
+      expectedPrior_(0),
+      receivedPrior_(0),
+      haveTransit_(false),
+      transit_(0),
+      jitter_(0),
+      lastSr_(0),
+      lastSrArrivalUs_(0) {}
+
+void RtpReceiveStats::initSequence(uint16_t seq) {
+    baseSeq_ = seq;
+    maxSeq_ = seq;
+    badSeq_ = kSeqMod + 1;
+    cycles_ = 0;
+    received_ = 0;
+    receivedPrior_ = 0;
+    expectedPrior_ = 0;
+}
+
+bool RtpReceiveStats::update(const RtpPacket& packet, int64_t arrivalUs) {
+    const uint16_t seq = packet.sequenceNumber();
+    const uint16_t udelta = static_cast<uint16_t>(seq - maxSeq_);
+
+    if (probation_ > 0) {
+        if (received_ == 0 && probation_ == kMinSequential) {
+            maxSeq_ = static_cast<uint16_t>(seq - 1);
+        }
+        if (seq == static_cast<uint16_t>(maxSeq_ + 1)) {
+            --probation_;
+            maxSeq_ = seq;
+            if (probation_ == 0) {
+                initSequence(seq);
+                ++received_;
+                return true;
+            }
+        } else {
+            probation_ = kMinSequential - 1;
+            maxSeq_ = seq;
+        }
+        return false;
+    } else if (udelta < kMaxDropout) {
+        if (seq < maxSeq_) {
+            cycles_ += kSeqMod;
+        }
+        maxSeq_ = seq;
+    } else if (udelta <= kSeqMod - kMaxMisorder) {
+        if (seq == badSeq_) {
+            // Two sequential packets after a big jump: the source restarted.
+            initSequence(seq);
+        } else {
+            badSeq_ = (seq + 1) & (kSeqMod - 1);
+            return false;
+        }
+    }
+    // else duplicate or reordered packet
+    ++received_;
+
+    // Split so a wall-clock arrivalUs times the clock rate can't overflow.
+    const uint32_t arrival = static_cast<uint32_t>((arrivalUs / 1000000) * clockRate_
+                                                   + (arrivalUs % 1000000) * clockRate_ / 1000000);
+    const uint32_t transit = arrival - packet.timestamp();
+    if (haveTransit_) {
+        int32_t d = static_cast<int32_t>(transit - transit_);
+        if (d < 0) {
+            d = -d;
+        }
+        jitter_ += d - ((jitter_ + 8) >> 4);
+    }
+    haveTransit_ = true;
+    transit_ = transit;
+    return true;
+}
+
+int64_t RtpReceiveStats::cumulativeLost() const {
+    const int64_t expected = static_cast<int64_t>(extendedHighestSeq()) - baseSeq_ + 1;
+    return expected - static_cast<int64_t>(received_);
+}
+
+void RtpReceiveStats::onSenderReport(const RtcpSenderInfo& info, int64_t arrivalUs) {
+    lastSr_ = static_cast<uint32_t>(info.ntpTimestamp >> 16);
+    lastSrArrivalUs_ = arrivalUs;
+}
+
+void RtpReceiveStats::fillReportBlock(uint32_t ssrc, int64_t nowUs, RtcpReportBlock* block) {
+    const uint64_t expected = static_cast<uint64_t>(extendedHighestSeq()) - baseSeq_ + 1;
+    const int64_t expectedInterval = static_cast<int64_t>(expected - expectedPrior_);
+    const int64_t receivedInterval = static_cast<int64_t>(received_ - receivedPrior_);
+    const int64_t lostInterval = expectedInterval - receivedInterval;
+    expectedPrior_ = expected;
+    receivedPrior_ = received_;
+
+    block->ssrc = ssrc;
+    block->fractionLost = (expectedInterval == 0 || lostInterval <= 0)
+        ? 0 : static_cast<uint8_t>((lostInterval << 8) / expectedInterval);
+    int64_t lost = cumulativeLost();
+    if (lost > 0x7fffff) {
+        lost = 0x7fffff;
+    } else if (lost < -0x800000) {
+        lost = -0x800000;
+    }
+    block->cumulativeLost = static_cast<int32_t>(lost);
+    block->extendedHighestSeq = extendedHighestSeq();
+    block->jitter = jitter();
+    block->lastSr = lastSr_;
+    // DLSR in units of 1/65536 seconds.
+    block->delaySinceLastSr = lastSr_ == 0
+        ? 0 : static_cast<uint32_t>((nowUs - lastSrArrivalUs_) * 65536 / 1000000);
+}
+
+RtpReceiver::RtpReceiver(const Config& config)
+    : config_(config) {}
+
+bool RtpReceiver::onDatagram(const char* data, size_t len, int64_t arrivalUs) {
+    if (rtp::isRtcp(data, len)) {
+        onRtcp(data, len, arrivalUs);
+        return true;
+    }
+    RtpPacket packet;
+    if (!packet.parse(data, len)) {
+        return false;
+    }
+    auto it = streams_.find(packet.ssrc());
+    if (it == streams_.end()) {
+        if (streams_.size() >= config_.maxStreams) {
+            RTCLOG(RTC_WARN, "RtpReceiver stream limit reached, dropped ssrc %u", packet.ssrc());
+            return false;
+        }
+        it = streams_.emplace(packet.ssrc(), std::unique_ptr<Stream>(new Stream(config_))).first;
+    }
+    Stream& stream = *it->second;
+    if (stream.stats.update(packet, arrivalUs)) {
+        stream.buffer.insert(packet, arrivalUs);
+    }
+    return true;
+}
+
+void RtpReceiver::onRtcp(const char* data, size_t len, int64_t arrivalUs) {
+    RtcpReader reader(data, len);
+    RtcpReader::Block block;
+    while (reader.next(&block)) {
+        if (block.type == kRtcpSr) {
+            RtcpSenderInfo info;
+            if (rtcp::parseSenderInfo(block, &info)) {
+                Stream* s = stream(info.ssrc);
+                if (s) {
+                    s->stats.onSenderReport(info, arrivalUs);
+                }
+            }
+        } else if (rtcpCallback_ && block.type != kRtcpRr) {
+            rtcpCallback_(block, arrivalUs);
+        }
+    }
+}
+
+RtpReceiver::Stream* RtpReceiver::stream(uint32_t ssrc) {
+    auto it = streams_.find(ssrc);
+    return it == streams_.end() ? nullptr : it->second.get();
+}
+
+size_t RtpReceiver::buildReceiverReport(uint32_t localSsrc, int64_t nowUs, char* out, size_t capacity) {
+    RtcpReportBlock blocks[kMaxReportBlocks];
+    size_t count = 0;
+    for (auto& it : streams_) {
+        if (count == kMaxReportBlocks) {
+            break;
+        }
+        if (it.second->stats.received() > 0) {
+            it.second->stats.fillReportBlock(it.first, nowUs, &blocks[count++]);
+        }
+    }
+    return rtcp::writeReceiverReport(localSsrc, blocks, count, out, capacity);
+}
+
+} // namespace hvnetpp
@@ -0,0 +1,268 @@
+#include "hvnetpp/ShmRing.h"
+#include "hvnetpp/Channel.h"
+#include "hvnetpp/CircularBuffer.h"
+#include "hvnetpp/EventLoop.h"
+#include "hvnetpp/SocketsOps.h"
+#include "rtclog.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace hvnetpp {
+
+// Lives in the first page of the segment. Lock-free atomics are
+// address-free, so they work across processes.
+struct ShmRing::Header {
+    uint32_t magic;
+    uint32_t order;
+    alignas(64) std::atomic<uint64_t> tail; // written by producer
+    alignas(64) std::atomic<uint64_t> head; // written by consumer
+    alignas(64) std::atomic<uint32_t> readerWaiting;
+};
+
+namespace {
+
+const uint32_t kMagic = 0x68767368; // "hvsh"
+const unsigned int kMinOrder = 12;
+const unsigned int kMaxOrder = 30;
+
+size_t pageSize() {
+    return static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+}
+
+int createMemfd(const std::string& name) {
+    return static_cast<int>(::syscall(SYS_memfd_create, name.c_str(), MFD_CLOEXEC));
+}
+
+} // namespace
+
+std::unique_ptr<ShmRing> ShmRing::create(EventLoop* loop, const std::string& name, unsigned int order) {
+    order = std::min(std::max(order, kMinOrder), kMaxOrder);
+    int memfd = createMemfd(name);
+    if (memfd < 0) {
+        RTCLOG(RTC_ERROR, "ShmRing::create memfd_create error: %s", strerror(errno));
+        return nullptr;
+    }
+    const size_t size = pageSize() + (1UL << order);
+    if (::ftruncate(memfd, static_cast<off_t>(size)) != 0) {
+        RTCLOG(RTC_ERROR, "ShmRing::create ftruncate error: %s", strerror(errno));
+        ::close(memfd);
+        return nullptr;
+    }
+    int evfd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (evfd < 0) {
+        RTCLOG(RTC_ERROR, "ShmRing::create eventfd error: %s", strerror(errno));
+        ::close(memfd);
+        return nullptr;
+    }
+    void* page = ::mmap(NULL, pageSize(), PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    if (page == MAP_FAILED) {
+        RTCLOG(RTC_ERROR, "ShmRing::create mmap error: %s", strerror(errno));
+        ::close(memfd);
+        ::close(evfd);
+        return nullptr;
+    }
+    Header* header = new (page) Header;
+    header->magic = kMagic;
+    header->order = order;
+    header->tail.store(0, std::memory_order_relaxed);
+    header->head.store(0, std::memory_order_relaxed);
+    header->readerWaiting.store(0, std::memory_order_relaxed);
+
+    std::unique_ptr<internal::CircularBuffer> ring(new internal::CircularBuffer(memfd, pageSize(), order));
+    if (!ring->isValid()) {
+        RTCLOG(RTC_ERROR, "ShmRing::create mirror mapping failed");
+        ::munmap(page, pageSize());
+        ::close(memfd);
+        ::close(evfd);
+        return nullptr;
+    }
+    return std::unique_ptr<ShmRing>(new ShmRing(loop, memfd, evfd, header, std::move(ring)));
+}
+
+std::unique_ptr<ShmRing> ShmRing::attach(EventLoop* loop, int memfd, int evfd) {
+    void* page = ::mmap(NULL, pageSize(), PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    if (page == MAP_FAILED) {
+        RTCLOG(RTC_ERROR, "ShmRing::attach mmap error: %s", strerror(errno));
+        ::close(memfd);
+        ::close(evfd);
+        return nullptr;
+    }
+    Header* header = static_cast<Header*>(page);
+    // The header comes from another process; read order once and bound it
+    // before shifting by it.
+    const uint32_t order = header->order;
+    struct stat st;
+    if (header->magic != kMagic || order < kMinOrder || order > kMaxOrder || ::fstat(memfd, &st) != 0
+        || static_cast<size_t>(st.st_size) != pageSize() + (1UL << order)) {
+        RTCLOG(RTC_ERROR, "ShmRing::attach bad segment");
+        ::munmap(page, pageSize());
+        ::close(memfd);
+        ::close(evfd);
+        return nullptr;
+    }
+    std::unique_ptr<internal::CircularBuffer> ring(new internal::CircularBuffer(memfd, pageSize(), order));
+    if (!ring->isValid()) {
+        RTCLOG(RTC_ERROR, "ShmRing::attach mirror mapping failed");
+        ::munmap(page, pageSize());
+        ::close(memfd);
+        ::close(evfd);
+        return nullptr;
+    }
+    return std::unique_ptr<ShmRing>(new ShmRing(loop, memfd, evfd, header, std::move(ring)));
+}
+
+std::unique_ptr<ShmRing> ShmRing::receiveFds(EventLoop* loop, int unixSockfd) {
+    int fds[2];
+    size_t nfds = 2;
+    char tag;
+    ssize_t n = sockets::recvFds(unixSockfd, fds, &nfds, &tag, sizeof tag);
+    if (n <= 0 || nfds != 2) {
+        RTCLOG(RTC_ERROR, "ShmRing::receiveFds got %zu fds", nfds);
+        for (size_t i = 0; i < nfds; ++i) {
+            ::close(fds[i]);
+        }
+        return nullptr;
+    }
+    return attach(loop, fds[0], fds[1]);
+}
+
+ShmRing::ShmRing(EventLoop* loop, int memfd, int evfd, Header* header,
+                 std::unique_ptr<internal::CircularBuffer> ring)
+    : loop_(loop),
+      memfd_(memfd),
+      eventfd_(evfd),
+      header_(header),
+      ring_(std::move(ring)),
+      channel_(new Channel(loop, evfd)) {
+    channel_->setReadCallback([this]() { handleRead(); });
+}
+
+ShmRing::~ShmRing() {
+    channel_->disableAll();
+    channel_->remove();
+    ring_.reset();
+    ::munmap(header_, pageSize());
+    ::close(eventfd_);
+    ::close(memfd_);
+}
+
+bool ShmRing::sendFds(int unixSockfd) const {
+    const int fds[2] = { memfd_, eventfd_ };
+    const char tag = 'R';
+    return sockets::sendFds(unixSockfd, fds, 2, &tag, sizeof tag) == 1;
+}
+
+size_t ShmRing::capacity() const {
+    return ring_->size();
+}
+
+// head and tail are written by the other process, so a broken peer can make
+// their distance anything; never report more than the ring holds.
+size_t ShmRing::usedBytes(uint64_t head, uint64_t tail) const {
+    return static_cast<size_t>(std::min<uint64_t>(tail - head, capacity()));
+}
+
+size_t ShmRing::writableBytes() const {
+    const uint64_t head = header_->head.load(std::memory_order_acquire);
+    const uint64_t tail = header_->tail.load(std::memory_order_relaxed);
+    return capacity() - usedBytes(head, tail);
+}
+
+bool ShmRing::append(const void* data, size_t len) {
+    if (len > writableBytes()) {
+        return false;
+    }
+    const uint64_t tail = header_->tail.load(std::memory_order_relaxed);
+    // The mirror makes the destination contiguous even across the wrap.
+    memcpy(ring_->getPointer(static_cast<unsigned int>(tail)), data, len);
+    header_->tail.store(tail + len, std::memory_order_release);
+    notify();
+    return true;
+}
+
+// Ring the doorbell only if the reader said it is about to sleep.
+void ShmRing::notify() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (header_->readerWaiting.exchange(0, std::memory_order_acq_rel) != 0) {
+        uint64_t one = 1;
+        ssize_t n = ::write(eventfd_, &one, sizeof one);
+        if (n != sizeof one) {
+            RTCLOG(RTC_ERROR, "ShmRing::notify writes %zd bytes instead of 8", n);
+        }
+    }
+}
+
+size_t ShmRing::readableBytes() const {
+    const uint64_t tail = header_->tail.load(std::memory_order_acquire);
+    const uint64_t head = header_->head.load(std::memory_order_relaxed);
+    return usedBytes(head, tail);
+}
+
+const char* ShmRing::peek() const {
+    const uint64_t head = header_->head.load(std::memory_order_relaxed);
+    return reinterpret_cast<const char*>(ring_->getPointer(static_cast<unsigned int>(head)));
+}
+
+void ShmRing::retrieve(size_t len) {
+    len = std::min(len, readableBytes());
+    const uint64_t head = header_->head.load(std::memory_order_relaxed);
+    header_->head.store(head + len, std::memory_order_release);
+}
+
+std::string ShmRing::retrieveAllAsString() {
+    std::string result(peek(), readableBytes());
+    retrieve(result.size());
+    return result;
+}
+
+void ShmRing::startReading() {
+    loop_->assertInLoopThread();
+    header_->readerWaiting.store(1, std::memory_order_seq_cst);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    channel_->enableReading();
+    // Data may have arrived before we started waiting.
+    if (readableBytes() > 0) {
+        loop_->queueInLoop([this]() { handleRead(); });
+    }
+}
+
+void ShmRing::stopReading() {
+    loop_->assertInLoopThread();
+    channel_->disableReading();
+}
+
+void ShmRing::handleRead() {
+    loop_->assertInLoopThread();
+    uint64_t count = 0;
+    ssize_t n = ::read(eventfd_, &count, sizeof count);
+    (void)n;
+    while (readCallback_) {
+        size_t before = readableBytes();
+        while (before > 0) {
+            readCallback_(this);
+            const size_t after = readableBytes();
+            if (after == before) {
+                break; // callback waits for more data
+            }
+            before = after;
+        }
+        header_->readerWaiting.store(1, std::memory_order_seq_cst);
+        // Pairs with the fence in notify(): either the writer sees the flag
+        // or the recheck below sees its tail.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        // Recheck so a write racing with the flag store is not missed.
+        if (readableBytes() == before) {
+            break;
+        }
+    }
+}
+
+} // namespace hvnetpp
@@ -5,27 +5,24 @@
 #include <stdio.h>
 #include <strings.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <unistd.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
 #include <assert.h>
+#include <algorithm>
+#include <cstddef>
 #include <cstdlib>
 #include <cstring>
+#include <vector>
 
 namespace hvnetpp {
 namespace sockets {
 
 using SA = struct sockaddr;
 
-namespace {
-
-socklen_t sockaddrLength(const struct sockaddr* addr) {
-    return static_cast<socklen_t>(
-        addr->sa_family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in));
-}
-
-} // namespace
-
 const SA* sockaddr_cast(const struct sockaddr_in* addr) {
     return static_cast<const SA*>(static_cast<const void*>(addr));
 }
@@ -38,6 +35,10 @@ SA* sockaddr_cast(struct sockaddr_in6* addr) {
     return static_cast<SA*>(static_cast<void*>(addr));
 }
 
+SA* sockaddr_cast(struct sockaddr_storage* addr) {
+    return static_cast<SA*>(static_cast<void*>(addr));
+}
+
 const struct sockaddr_in* sockaddr_in_cast(const struct sockaddr* addr) {
     return static_cast<const struct sockaddr_in*>(static_cast<const void*>(addr));
 }
@@ -46,8 +47,24 @@ const struct sockaddr_in6* sockaddr_in6_cast(const struct sockaddr* addr) {
     return static_cast<const struct sockaddr_in6*>(static_cast<const void*>(addr));
 }
 
+socklen_t sockaddrLength(const struct sockaddr* addr) {
+    if (addr->sa_family == AF_INET6) {
+        return static_cast<socklen_t>(sizeof(struct sockaddr_in6));
+    }
+    if (addr->sa_family == AF_UNIX) {
+        const struct sockaddr_un* un = static_cast<const struct sockaddr_un*>(static_cast<const void*>(addr));
+        const size_t maxLen = sizeof un->sun_path;
+        size_t len = un->sun_path[0] != '\0'
+            ? strnlen(un->sun_path, maxLen) + 1
+            : 1 + strnlen(un->sun_path + 1, maxLen - 1);
+        return static_cast<socklen_t>(offsetof(struct sockaddr_un, sun_path) + std::min(len, maxLen));
+    }
+    return static_cast<socklen_t>(sizeof(struct sockaddr_in));
+}
+
 int createNonblockingOrDie(sa_family_t family) {
-    int sockfd = ::socket(family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP);
+    // AF_UNIX stream sockets take the default protocol.
+    int sockfd = ::socket(family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, family == AF_UNIX ? 0 : IPPROTO_TCP);
     if (sockfd < 0) {
         RTCLOG(RTC_FATAL, "sockets::createNonblockingOrDie");
         abort();
@@ -80,7 +97,9 @@ void listenOrDie(int sockfd) {
     }
 }
 
-int accept(int sockfd, struct sockaddr_in6* addr) {
+int accept(int sockfd, struct sockaddr_storage* addr) {
+    // Unnamed AF_UNIX peers only fill in the family.
+    bzero(addr, sizeof *addr);
     socklen_t addrlen = static_cast<socklen_t>(sizeof *addr);
     int connfd = ::accept4(sockfd, sockaddr_cast(addr),
                            &addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
@@ -121,6 +140,10 @@ int connect(int sockfd, const struct sockaddr* addr) {
     return ::connect(sockfd, addr, sockaddrLength(addr));
 }
 
+int bind(int sockfd, const struct sockaddr* addr) {
+    return ::bind(sockfd, addr, sockaddrLength(addr));
+}
+
 ssize_t read(int sockfd, void *buf, size_t count) {
     return ::read(sockfd, buf, count);
 }
@@ -139,6 +162,71 @@ void close(int sockfd) {
     }
 }
 
+ssize_t sendFds(int sockfd, const int* fds, size_t nfds, const void* data, size_t len) {
+    assert(len > 0);
+    struct iovec iov;
+    iov.iov_base = const_cast<void*>(data);
+    iov.iov_len = len;
+
+    std::vector<char> control(CMSG_SPACE(nfds * sizeof(int)));
+    struct msghdr msg;
+    bzero(&msg, sizeof msg);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (nfds > 0) {
+        msg.msg_control = control.data();
+        msg.msg_controllen = control.size();
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), fds, nfds * sizeof(int));
+    }
+    ssize_t n = ::sendmsg(sockfd, &msg, MSG_NOSIGNAL);
+    if (n < 0) {
+        RTCLOG(RTC_ERROR, "sockets::sendFds error: %s", strerror(errno));
+    }
+    return n;
+}
+
+ssize_t recvFds(int sockfd, int* fds, size_t* nfds, void* data, size_t len) {
+    struct iovec iov;
+    iov.iov_base = data;
+    iov.iov_len = len;
+
+    std::vector<char> control(CMSG_SPACE(*nfds * sizeof(int)));
+    struct msghdr msg;
+    bzero(&msg, sizeof msg);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.data();
+    msg.msg_controllen = control.size();
+
+    const size_t maxFds = *nfds;
+    *nfds = 0;
+    ssize_t n = ::recvmsg(sockfd, &msg, MSG_CMSG_CLOEXEC);
+    if (n < 0) {
+        return n;
+    }
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            const int* received = reinterpret_cast<const int*>(CMSG_DATA(cmsg));
+            for (size_t i = 0; i < count; ++i) {
+                if (*nfds < maxFds) {
+                    fds[(*nfds)++] = received[i];
+                } else {
+                    ::close(received[i]);
+                }
+            }
+        }
+    }
+    if (msg.msg_flags & MSG_CTRUNC) {
+        RTCLOG(RTC_WARN, "sockets::recvFds control data truncated");
+    }
+    return n;
+}
+
 void shutdownWrite(int sockfd) {
     if (::shutdown(sockfd, SHUT_WR) < 0) {
         RTCLOG(RTC_ERROR, "sockets::shutdownWrite error: %s", strerror(errno));
@@ -157,6 +245,8 @@ void toIpPort(char* buf, size_t size, const struct sockaddr* addr) {
         const struct sockaddr_in6* addr6 = sockaddr_in6_cast(addr);
         port = ntohs(addr6->sin6_port);
         snprintf(buf, size, "[%s]:%u", ip, port);
+    } else if (addr->sa_family == AF_UNIX) {
+        toIp(buf, size, addr);
     } else if (size > 0) {
         buf[0] = '\0';
     }
@@ -171,6 +261,16 @@ void toIp(char* buf, size_t size, const struct sockaddr* addr) {
         assert(size >= INET6_ADDRSTRLEN);
         const struct sockaddr_in6* addr6 = sockaddr_in6_cast(addr);
         ::inet_ntop(AF_INET6, &addr6->sin6_addr, buf, static_cast<socklen_t>(size));
+    } else if (addr->sa_family == AF_UNIX && size > 0) {
+        // Abstract names are shown with a leading '@'.
+        const struct sockaddr_un* un = static_cast<const struct sockaddr_un*>(static_cast<const void*>(addr));
+        if (un->sun_path[0] != '\0') {
+            snprintf(buf, size, "%.*s", static_cast<int>(sizeof un->sun_path), un->sun_path);
+        } else if (un->sun_path[1] != '\0') {
+            snprintf(buf, size, "@%.*s", static_cast<int>(sizeof un->sun_path - 1), un->sun_path + 1);
+        } else {
+            snprintf(buf, size, "unix:unnamed");
+        }
     }
 }
 
@@ -206,8 +306,8 @@ int getSocketError(int sockfd) {
     }
 }
 
-struct sockaddr_in6 getLocalAddr(int sockfd) {
-    struct sockaddr_in6 localaddr;
+struct sockaddr_storage getLocalAddr(int sockfd) {
+    struct sockaddr_storage localaddr;
     bzero(&localaddr, sizeof localaddr);
     socklen_t addrlen = static_cast<socklen_t>(sizeof localaddr);
     if (::getsockname(sockfd, sockaddr_cast(&localaddr), &addrlen) < 0) {
@@ -216,8 +316,8 @@ struct sockaddr_in6 getLocalAddr(int sockfd) {
     return localaddr;
 }
 
-struct sockaddr_in6 getPeerAddr(int sockfd) {
-    struct sockaddr_in6 peeraddr;
+struct sockaddr_storage getPeerAddr(int sockfd) {
+    struct sockaddr_storage peeraddr;
     bzero(&peeraddr, sizeof peeraddr);
     socklen_t addrlen = static_cast<socklen_t>(sizeof peeraddr);
     if (::getpeername(sockfd, sockaddr_cast(&peeraddr), &addrlen) < 0) {
@@ -227,16 +327,18 @@ struct sockaddr_in6 getPeerAddr(int sockfd) {
 }
 
 bool isSelfConnect(int sockfd) {
-    struct sockaddr_in6 localaddr = getLocalAddr(sockfd);
-    struct sockaddr_in6 peeraddr = getPeerAddr(sockfd);
-    if (localaddr.sin6_family == AF_INET) {
+    struct sockaddr_storage localaddr = getLocalAddr(sockfd);
+    struct sockaddr_storage peeraddr = getPeerAddr(sockfd);
+    if (localaddr.ss_family == AF_INET) {
         const struct sockaddr_in* laddr4 = reinterpret_cast<struct sockaddr_in*>(&localaddr);
         const struct sockaddr_in* raddr4 = reinterpret_cast<struct sockaddr_in*>(&peeraddr);
         return laddr4->sin_port == raddr4->sin_port
             && laddr4->sin_addr.s_addr == raddr4->sin_addr.s_addr;
-    } else if (localaddr.sin6_family == AF_INET6) {
-        return localaddr.sin6_port == peeraddr.sin6_port
-            && memcmp(&localaddr.sin6_addr, &peeraddr.sin6_addr, sizeof localaddr.sin6_addr) == 0;
+    } else if (localaddr.ss_family == AF_INET6) {
+        const struct sockaddr_in6* laddr6 = reinterpret_cast<struct sockaddr_in6*>(&localaddr);
+        const struct sockaddr_in6* raddr6 = reinterpret_cast<struct sockaddr_in6*>(&peeraddr);
+        return laddr6->sin6_port == raddr6->sin6_port
+            && memcmp(&laddr6->sin6_addr, &raddr6->sin6_addr, sizeof laddr6->sin6_addr) == 0;
     } else {
         return false;
     }
@@ -262,5 +364,83 @@ void setKeepAlive(int sockfd, bool on) {
     ::setsockopt(sockfd, SOL_SOCKET, SO_KEEPALIVE, &optval, static_cast<socklen_t>(sizeof optval));
 }
 
+bool enableRxTimestamps(int sockfd) {
+    int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+    if (::setsockopt(sockfd, SOL_SOCKET, SO_TIMESTAMPING, &flags, static_cast<socklen_t>(sizeof flags)) == 0) {
+        return true;
+    }
+    int on = 1;
+    if (::setsockopt(sockfd, SOL_SOCKET, SO_TIMESTAMPNS, &on, static_cast<socklen_t>(sizeof on)) == 0) {
+        return true;
+    }
+    RTCLOG(RTC_WARN, "sockets::enableRxTimestamps fd=%d: %s", sockfd, strerror(errno));
+    return false;
+}
+
+bool enableTxTimestamps(int sockfd) {
+    // OPT_ID tags each report with the byte offset of the send it belongs
+    // to, OPT_TSONLY keeps the payload out of the error queue.
+    int flags = SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_TX_ACK | SOF_TIMESTAMPING_SOFTWARE
+        | SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+    if (::setsockopt(sockfd, SOL_SOCKET, SO_TIMESTAMPING, &flags, static_cast<socklen_t>(sizeof flags)) != 0) {
+        RTCLOG(RTC_WARN, "sockets::enableTxTimestamps fd=%d: %s", sockfd, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+void disableTimestamps(int sockfd) {
+    int flags = 0;
+    if (::setsockopt(sockfd, SOL_SOCKET, SO_TIMESTAMPING, &flags, static_cast<socklen_t>(sizeof flags)) != 0) {
+        RTCLOG(RTC_WARN, "sockets::disableTimestamps fd=%d: %s", sockfd, strerror(errno));
+    }
+}
+
+int64_t rxTimestampNs(const struct msghdr& msg) {
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+         cmsg = CMSG_NXTHDR(const_cast<struct msghdr*>(&msg), cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET) {
+            continue;
+        }
+        if (cmsg->cmsg_type == SCM_TIMESTAMPING || cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+            // SCM_TIMESTAMPING carries three timespecs, software first.
+            struct timespec ts;
+            memcpy(&ts, CMSG_DATA(cmsg), sizeof ts);
+            return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+        }
+    }
+    return 0;
+}
+
+bool readTxTimestamp(int sockfd, TxTimestamp* out) {
+    char control[CMSG_SPACE(sizeof(struct scm_timestamping)) + CMSG_SPACE(sizeof(struct sock_extended_err) + sizeof(struct sockaddr_storage))];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof msg);
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof control;
+    if (::recvmsg(sockfd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+        return false;
+    }
+    out->timestampNs = 0;
+    out->type = -1;
+    out->id = 0;
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING) {
+            struct scm_timestamping tss;
+            memcpy(&tss, CMSG_DATA(cmsg), sizeof tss);
+            out->timestampNs = static_cast<int64_t>(tss.ts[0].tv_sec) * 1000000000 + tss.ts[0].tv_nsec;
+        } else if ((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR)
+                   || (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)) {
+            struct sock_extended_err err;
+            memcpy(&err, CMSG_DATA(cmsg), sizeof err);
+            if (err.ee_errno == ENOMSG && err.ee_origin == SO_EE_ORIGIN_TIMESTAMPING) {
+                out->type = static_cast<int>(err.ee_info);
+                out->id = err.ee_data;
+            }
+        }
+    }
+    return true;
+}
+
 } // namespace sockets
 } // namespace hvnetpp
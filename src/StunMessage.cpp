@@ -0,0 +1,483 @@
+#include "hvnetpp/StunMessage.h"
+#include "hvnetpp/InetAddress.h"
+#include "hvnetpp/RtpPacket.h"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cstring>
+#include <vector>
+
+namespace hvnetpp {
+
+namespace {
+
+const uint32_t kFingerprintXor = 0x5354554e;
+const size_t kIntegritySize = 20;
+const size_t kSha1BlockSize = 64;
+
+uint32_t rotl(uint32_t x, int n) {
+    return (x << n) | (x >> (32 - n));
+}
+
+void sha1Compress(uint32_t state[5], const uint8_t block[kSha1BlockSize]) {
+    uint32_t w[80];
+    for (int i = 0; i < 16; ++i) {
+        w[i] = rtp::readBe32(block + 4 * i);
+    }
+    for (int i = 16; i < 80; ++i) {
+        w[i] = rotl(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+    for (int i = 0; i < 80; ++i) {
+        uint32_t f, k;
+        if (i < 20) {
+            f = (b & c) | (~b & d);
+            k = 0x5A827999;
+        } else if (i < 40) {
+            f = b ^ c ^ d;
+            k = 0x6ED9EBA1;
+        } else if (i < 60) {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8F1BBCDC;
+        } else {
+            f = b ^ c ^ d;
+            k = 0xCA62C1D6;
+        }
+        const uint32_t t = rotl(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = rotl(b, 30);
+        b = a;
+        a = t;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+}
+
+// Streaming SHA-1 that can start from a precomputed state.
+class Sha1 {
+public:
+    explicit Sha1(const uint32_t* state, uint64_t consumed = kSha1BlockSize)
+        : buffered_(0), total_(consumed) {
+        memcpy(state_, state, sizeof state_);
+    }
+
+    void update(const void* data, size_t len) {
+        const uint8_t* p = static_cast<const uint8_t*>(data);
+        total_ += len;
+        if (buffered_ > 0) {
+            const size_t n = std::min(len, kSha1BlockSize - buffered_);
+            memcpy(block_ + buffered_, p, n);
+            buffered_ += n;
+            p += n;
+            len -= n;
+            if (buffered_ < kSha1BlockSize) {
+                return;
+            }
+            sha1Compress(state_, block_);
+            buffered_ = 0;
+        }
+        while (len >= kSha1BlockSize) {
+            sha1Compress(state_, p);
+            p += kSha1BlockSize;
+            len -= kSha1BlockSize;
+        }
+        memcpy(block_, p, len);
+        buffered_ = len;
+    }
+
+    void final(uint8_t digest[20]) {
+        const uint64_t bits = total_ * 8;
+        block_[buffered_++] = 0x80;
+        if (buffered_ > kSha1BlockSize - 8) {
+            memset(block_ + buffered_, 0, kSha1BlockSize - buffered_);
+            sha1Compress(state_, block_);
+            buffered_ = 0;
+        }
+        memset(block_ + buffered_, 0, kSha1BlockSize - 8 - buffered_);
+        rtp::writeBe32(block_ + 56, static_cast<uint32_t>(bits >> 32));
+        rtp::writeBe32(block_ + 60, static_cast<uint32_t>(bits));
+        sha1Compress(state_, block_);
+        for (int i = 0; i < 5; ++i) {
+            rtp::writeBe32(digest + 4 * i, state_[i]);
+        }
+    }
+
+private:
+    uint32_t state_[5];
+    uint8_t block_[kSha1BlockSize];
+    size_t buffered_;
+    uint64_t total_;
+};
+
+const uint32_t kSha1Init[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+
+// HMAC over a STUN message prefix of @c len bytes whose header length
+// field is replaced by @c lengthField.
+void messageHmac(const stun::IntegrityKey& key, const char* data, size_t len,
+                 uint16_t lengthField, uint8_t digest[20]) {
+    uint8_t header[4];
+    memcpy(header, data, 2);
+    rtp::writeBe16(header + 2, lengthField);
+    Sha1 inner(key.inner);
+    inner.update(header, sizeof header);
+    inner.update(data + 4, len - 4);
+    uint8_t innerDigest[20];
+    inner.final(innerDigest);
+    Sha1 outer(key.outer);
+    outer.update(innerDigest, sizeof innerDigest);
+    outer.final(digest);
+}
+
+uint32_t crc32(const char* data, size_t len, uint16_t lengthField) {
+    static uint32_t table[256];
+    static bool initialized = [] {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) {
+                c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+            }
+            table[i] = c;
+        }
+        return true;
+    }();
+    (void)initialized;
+    uint8_t header[4];
+    memcpy(header, data, 2);
+    rtp::writeBe16(header + 2, lengthField);
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < len; ++i) {
+        const uint8_t b = i < 4 ? header[i] : static_cast<uint8_t>(data[i]);
+        crc = table[(crc ^ b) & 0xff] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFF;
+}
+
+
+// MD5 (RFC 1321), only used to derive long-term credential keys.
+void md5(const uint8_t* data, size_t len, uint8_t digest[16]) {
+    static const uint32_t k[64] = {
+        0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+        0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+        0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+        0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+        0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+        0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+        0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+        0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+    };
+    static const int r[64] = {
+        7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+        5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20,
+        4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+        6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21,
+    };
+    uint32_t h[4] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476 };
+    std::vector<uint8_t> msg(data, data + len);
+    msg.push_back(0x80);
+    while (msg.size() % 64 != 56) {
+        msg.push_back(0);
+    }
+    const uint64_t bits = static_cast<uint64_t>(len) * 8;
+    for (int i = 0; i < 8; ++i) {
+        msg.push_back(static_cast<uint8_t>(bits >> (8 * i)));
+    }
+    for (size_t offset = 0; offset < msg.size(); offset += 64) {
+        uint32_t w[16];
+        for (int i = 0; i < 16; ++i) {
+            const uint8_t* q = &msg[offset + 4 * i];
+            w[i] = q[0] | (q[1] << 8) | (q[2] << 16) | (static_cast<uint32_t>(q[3]) << 24);
+        }
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3];
+        for (int i = 0; i < 64; ++i) {
+            uint32_t f;
+            int g;
+            if (i < 16) {
+                f = (b & c) | (~b & d);
+                g = i;
+            } else if (i < 32) {
+                f = (d & b) | (~d & c);
+                g = (5 * i + 1) % 16;
+            } else if (i < 48) {
+                f = b ^ c ^ d;
+                g = (3 * i + 5) % 16;
+            } else {
+                f = c ^ (b | ~d);
+                g = (7 * i) % 16;
+            }
+            const uint32_t t = d;
+            d = c;
+            c = b;
+            b = b + rotl(a + f + k[i] + w[g], r[i]);
+            a = t;
+        }
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+    }
+    for (int i = 0; i < 4; ++i) {
+        for (int j = 0; j < 4; ++j) {
+            digest[4 * i + j] = static_cast<uint8_t>(h[i] >> (8 * j));
+        }
+    }
+}
+
+} // namespace
+
+namespace stun {
+
+void prepareKey(const char* key, size_t len, IntegrityKey* out) {
+    uint8_t block[kSha1BlockSize];
+    memset(block, 0, sizeof block);
+    if (len > kSha1BlockSize) {
+        Sha1 sha(kSha1Init, 0);
+        sha.update(key, len);
+        sha.final(block);
+    } else {
+        memcpy(block, key, len);
+    }
+    uint8_t pad[kSha1BlockSize];
+    for (size_t i = 0; i < kSha1BlockSize; ++i) {
+        pad[i] = block[i] ^ 0x36;
+    }
+    memcpy(out->inner, kSha1Init, sizeof out->inner);
+    sha1Compress(out->inner, pad);
+    for (size_t i = 0; i < kSha1BlockSize; ++i) {
+        pad[i] = block[i] ^ 0x5c;
+    }
+    memcpy(out->outer, kSha1Init, sizeof out->outer);
+    sha1Compress(out->outer, pad);
+}
+
+void prepareLongTermKey(const std::string& username, const std::string& realm,
+                        const std::string& password, IntegrityKey* out) {
+    const std::string input = username + ":" + realm + ":" + password;
+    uint8_t digest[16];
+    md5(reinterpret_cast<const uint8_t*>(input.data()), input.size(), digest);
+    prepareKey(reinterpret_cast<const char*>(digest), sizeof digest, out);
+}
+
+bool readXorAddress(const char* value, size_t len, const char* transactionId, InetAddress* out) {
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(value);
+    if (len < 8) {
+        return false;
+    }
+    const uint16_t port = rtp::readBe16(p + 2) ^ static_cast<uint16_t>(kMagicCookie >> 16);
+    if (p[1] == 0x01 && len == 8) {
+        struct sockaddr_in sin;
+        memset(&sin, 0, sizeof sin);
+        sin.sin_family = AF_INET;
+        sin.sin_port = htons(port);
+        sin.sin_addr.s_addr = htonl(rtp::readBe32(p + 4) ^ kMagicCookie);
+        *out = InetAddress(sin);
+        return true;
+    }
+    if (p[1] == 0x02 && len == 20) {
+        uint8_t mask[16];
+        rtp::writeBe32(mask, kMagicCookie);
+        memcpy(mask + 4, transactionId, kTransactionIdSize);
+        struct sockaddr_in6 sin6;
+        memset(&sin6, 0, sizeof sin6);
+        sin6.sin6_family = AF_INET6;
+        sin6.sin6_port = htons(port);
+        for (int i = 0; i < 16; ++i) {
+            sin6.sin6_addr.s6_addr[i] = p[4 + i] ^ mask[i];
+        }
+        *out = InetAddress(sin6);
+        return true;
+    }
+    return false;
+}
+
+} // namespace stun
+
+bool StunMessage::parse(const char* data, size_t len) {
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(data);
+    if (len < stun::kHeaderSize || (p[0] & 0xc0) != 0
+        || rtp::readBe32(p + 4) != stun::kMagicCookie
+        || rtp::readBe16(p + 2) != len - stun::kHeaderSize || (len & 3) != 0) {
+        return false;
+    }
+    usernameOffset_ = 0;
+    usernameSize_ = 0;
+    integrityOffset_ = 0;
+    size_t offset = stun::kHeaderSize;
+    while (offset + 4 <= len) {
+        const uint16_t type = rtp::readBe16(p + offset);
+        const size_t attrLen = rtp::readBe16(p + offset + 2);
+        const size_t padded = (attrLen + 3) & ~static_cast<size_t>(3);
+        if (offset + 4 + padded > len) {
+            return false;
+        }
+        if (type == stun::kAttrFingerprint) {
+            if (attrLen != 4 || offset + 8 != len) {
+                return false;
+            }
+            const uint32_t crc = crc32(data, offset, static_cast<uint16_t>(len - stun::kHeaderSize));
+            if ((crc ^ kFingerprintXor) != rtp::readBe32(p + offset + 4)) {
+                return false;
+            }
+        } else if (integrityOffset_ == 0) {
+            if (type == stun::kAttrUsername) {
+                usernameOffset_ = offset + 4;
+                usernameSize_ = attrLen;
+            } else if (type == stun::kAttrMessageIntegrity) {
+                if (attrLen != kIntegritySize) {
+                    return false;
+                }
+                integrityOffset_ = offset;
+            }
+        }
+        offset += 4 + padded;
+    }
+    data_ = data;
+    size_ = len;
+    return offset == len;
+}
+
+uint16_t StunMessage::type() const {
+    return rtp::readBe16(reinterpret_cast<const uint8_t*>(data_));
+}
+
+bool StunMessage::findAttribute(uint16_t type, const char** value, size_t* len) const {
+    size_t cursor = 0;
+    uint16_t attrType;
+    while (nextAttribute(&cursor, &attrType, value, len)) {
+        if (attrType == type) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool StunMessage::nextAttribute(size_t* cursor, uint16_t* type, const char** value, size_t* len) const {
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(data_);
+    const size_t end = integrityOffset_ != 0 ? integrityOffset_ : size_;
+    size_t offset = *cursor == 0 ? stun::kHeaderSize : *cursor;
+    if (offset + 4 > end) {
+        return false;
+    }
+    *type = rtp::readBe16(p + offset);
+    *len = rtp::readBe16(p + offset + 2);
+    *value = data_ + offset + 4;
+    *cursor = offset + 4 + ((*len + 3) & ~static_cast<size_t>(3));
+    return true;
+}
+
+bool StunMessage::verifyIntegrity(const stun::IntegrityKey& key) const {
+    if (integrityOffset_ == 0) {
+        return false;
+    }
+    uint8_t digest[20];
+    const uint16_t lengthField = static_cast<uint16_t>(integrityOffset_ + 4 + kIntegritySize - stun::kHeaderSize);
+    messageHmac(key, data_, integrityOffset_, lengthField, digest);
+    const uint8_t* mac = reinterpret_cast<const uint8_t*>(data_ + integrityOffset_ + 4);
+    uint8_t diff = 0;
+    for (size_t i = 0; i < kIntegritySize; ++i) {
+        diff |= digest[i] ^ mac[i];
+    }
+    return diff == 0;
+}
+
+StunWriter::StunWriter(char* buf, size_t capacity, uint16_t type, const char* transactionId)
+    : buf_(buf), capacity_(capacity), size_(stun::kHeaderSize), ok_(capacity >= stun::kHeaderSize) {
+    if (!ok_) {
+        return;
+    }
+    uint8_t* p = reinterpret_cast<uint8_t*>(buf_);
+    rtp::writeBe16(p, type);
+    rtp::writeBe16(p + 2, 0);
+    rtp::writeBe32(p + 4, stun::kMagicCookie);
+    memcpy(p + 8, transactionId, stun::kTransactionIdSize);
+}
+
+char* StunWriter::reserve(uint16_t type, size_t len) {
+    const size_t padded = (len + 3) & ~static_cast<size_t>(3);
+    if (!ok_ || size_ + 4 + padded > capacity_ || len > 0xffff) {
+        ok_ = false;
+        return nullptr;
+    }
+    uint8_t* p = reinterpret_cast<uint8_t*>(buf_ + size_);
+    rtp::writeBe16(p, type);
+    rtp::writeBe16(p + 2, static_cast<uint16_t>(len));
+    memset(p + 4 + len, 0, padded - len);
+    size_ += 4 + padded;
+    setLength(size_ - stun::kHeaderSize);
+    return reinterpret_cast<char*>(p + 4);
+}
+
+void StunWriter::setLength(size_t bodySize) {
+    rtp::writeBe16(reinterpret_cast<uint8_t*>(buf_) + 2, static_cast<uint16_t>(bodySize));
+}
+
+void StunWriter::addAttribute(uint16_t type, const char* value, size_t len) {
+    char* p = reserve(type, len);
+    if (p) {
+        memcpy(p, value, len);
+    }
+}
+
+void StunWriter::addUint32(uint16_t type, uint32_t value) {
+    uint8_t* p = reinterpret_cast<uint8_t*>(reserve(type, 4));
+    if (p) {
+        rtp::writeBe32(p, value);
+    }
+}
+
+void StunWriter::addErrorCode(int code, const char* reason) {
+    const size_t reasonLen = strlen(reason);
+    uint8_t* p = reinterpret_cast<uint8_t*>(reserve(stun::kAttrErrorCode, 4 + reasonLen));
+    if (p) {
+        p[0] = 0;
+        p[1] = 0;
+        p[2] = static_cast<uint8_t>(code / 100);
+        p[3] = static_cast<uint8_t>(code % 100);
+        memcpy(p + 4, reason, reasonLen);
+    }
+}
+
+void StunWriter::addXorAddress(uint16_t type, const InetAddress& addr) {
+    const bool v6 = addr.family() == AF_INET6;
+    uint8_t* p = reinterpret_cast<uint8_t*>(reserve(type, v6 ? 20 : 8));
+    if (!p) {
+        return;
+    }
+    p[0] = 0;
+    p[1] = v6 ? 0x02 : 0x01;
+    rtp::writeBe16(p + 2, static_cast<uint16_t>(addr.toPort() ^ (stun::kMagicCookie >> 16)));
+    if (v6) {
+        // XORed with the magic cookie followed by the transaction id.
+        const struct sockaddr_in6* sin6 = reinterpret_cast<const struct sockaddr_in6*>(addr.getSockAddr());
+        const uint8_t* mask = reinterpret_cast<const uint8_t*>(buf_ + 4);
+        for (int i = 0; i < 16; ++i) {
+            p[4 + i] = sin6->sin6_addr.s6_addr[i] ^ mask[i];
+        }
+    } else {
+        const struct sockaddr_in* sin = reinterpret_cast<const struct sockaddr_in*>(addr.getSockAddr());
+        rtp::writeBe32(p + 4, ntohl(sin->sin_addr.s_addr) ^ stun::kMagicCookie);
+    }
+}
+
+void StunWriter::addMessageIntegrity(const stun::IntegrityKey& key) {
+    const size_t offset = size_;
+    char* p = reserve(stun::kAttrMessageIntegrity, kIntegritySize);
+    if (p) {
+        messageHmac(key, buf_, offset, static_cast<uint16_t>(size_ - stun::kHeaderSize),
+                    reinterpret_cast<uint8_t*>(p));
+    }
+}
+
+void StunWriter::addFingerprint() {
+    const size_t offset = size_;
+    uint8_t* p = reinterpret_cast<uint8_t*>(reserve(stun::kAttrFingerprint, 4));
+    if (p) {
+        const uint32_t crc = crc32(buf_, offset, static_cast<uint16_t>(size_ - stun::kHeaderSize));
+        rtp::writeBe32(p, crc ^ kFingerprintXor);
+    }
+}
+
+} // namespace hvnetpp
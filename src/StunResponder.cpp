@@ -0,0 +1,99 @@
+#include "hvnetpp/StunResponder.h"
+#include "hvnetpp/InetAddress.h"
+#include "hvnetpp/UdpSocket.h"
+
+#include <cstring>
+
+namespace hvnetpp {
+
+namespace {
+
+// Header, XOR-MAPPED-ADDRESS (v6), MESSAGE-INTEGRITY and FINGERPRINT.
+const size_t kResponseSize = stun::kHeaderSize + 24 + 24 + 8;
+
+uint64_t hashUfrag(const char* data, size_t len) {
+    uint64_t h = 14695981039346656037ULL; // FNV-1a
+    for (size_t i = 0; i < len; ++i) {
+        h = (h ^ static_cast<uint8_t>(data[i])) * 1099511628211ULL;
+    }
+    return h;
+}
+
+} // namespace
+
+StunResponder::StunResponder()
+    : stats_{0, 0, 0} {}
+
+void StunResponder::addCredential(const std::string& localUfrag, const std::string& password) {
+    removeCredential(localUfrag);
+    Credential credential;
+    credential.ufrag = localUfrag;
+    stun::prepareKey(password.data(), password.size(), &credential.key);
+    credentials_.emplace(hashUfrag(localUfrag.data(), localUfrag.size()), credential);
+}
+
+void StunResponder::removeCredential(const std::string& localUfrag) {
+    auto range = credentials_.equal_range(hashUfrag(localUfrag.data(), localUfrag.size()));
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second.ufrag == localUfrag) {
+            credentials_.erase(it);
+            return;
+        }
+    }
+}
+
+const StunResponder::Credential* StunResponder::findCredential(const char* ufrag, size_t len) const {
+    auto range = credentials_.equal_range(hashUfrag(ufrag, len));
+    for (auto it = range.first; it != range.second; ++it) {
+        const std::string& candidate = it->second.ufrag;
+        if (candidate.size() == len && memcmp(candidate.data(), ufrag, len) == 0) {
+            return &it->second;
+        }
+    }
+    return nullptr;
+}
+
+bool StunResponder::handle(UdpSocket* socket, const InetAddress& peerAddr, const char* data, size_t len) {
+    if (stun::classify(data, len) != stun::kStunPacket) {
+        return false;
+    }
+    StunMessage request;
+    if (!request.parse(data, len)) {
+        return false;
+    }
+    if (request.type() == stun::kBindingIndication) {
+        return true; // keepalive, nothing to answer
+    }
+    if (request.type() != stun::kBindingRequest) {
+        return false;
+    }
+    ++stats_.requests;
+
+    const Credential* credential = nullptr;
+    if (request.hasUsername() && request.hasIntegrity()) {
+        const char* username = request.username();
+        const void* colon = memchr(username, ':', request.usernameSize());
+        const size_t ufragLen = colon
+            ? static_cast<size_t>(static_cast<const char*>(colon) - username) : request.usernameSize();
+        credential = findCredential(username, ufragLen);
+    }
+    if (!credential || !request.verifyIntegrity(credential->key)) {
+        ++stats_.rejected;
+        return true;
+    }
+
+    char response[kResponseSize];
+    StunWriter writer(response, sizeof response, stun::kBindingSuccess, request.transactionId());
+    writer.addXorMappedAddress(peerAddr);
+    writer.addMessageIntegrity(credential->key);
+    writer.addFingerprint();
+    if (socket->sendTo(response, writer.size(), peerAddr) >= 0) {
+        ++stats_.responses;
+    }
+    if (bindingCallback_) {
+        bindingCallback_(peerAddr, request);
+    }
+    return true;
+}
+
+} // namespace hvnetpp
@@ -0,0 +1,106 @@
+#include "hvnetpp/TcpClient.h"
+#include "hvnetpp/Connector.h"
+#include "hvnetpp/EventLoop.h"
+#include "hvnetpp/PoolAllocator.h"
+#include "hvnetpp/SocketsOps.h"
+#include "rtclog.h"
+#include <assert.h>
+
+namespace hvnetpp {
+
+namespace {
+
+void removeConnectionDetached(EventLoop* loop, const TcpConnectionPtr& conn) {
+    loop->queueInLoop(std::bind(&TcpConnection::connectDestroyed, conn));
+}
+
+} // namespace
+
+TcpClient::TcpClient(EventLoop* loop, const InetAddress& serverAddr, const std::string& nameArg)
+    : loop_(loop),
+      connector_(std::make_shared<Connector>(loop, serverAddr)),
+      name_(nameArg),
+      connNamePrefix_(std::make_shared<const std::string>(name_ + "-" + serverAddr.toIpPort())),
+      retry_(false),
+      connect_(true),
+      nextConnId_(1) {
+    connector_->setNewConnectionCallback(std::bind(&TcpClient::newConnection, this, std::placeholders::_1));
+}
+
+TcpClient::~TcpClient() {
+    TcpConnectionPtr conn;
+    bool unique = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        unique = connection_.unique();
+        conn = connection_;
+    }
+    if (conn) {
+        assert(loop_ == conn->getLoop());
+        // The connection may outlive us, so it must not call back into this client.
+        EventLoop* loop = loop_;
+        loop_->runInLoop([conn, loop]() {
+            conn->setCloseCallback(std::bind(&removeConnectionDetached, loop, std::placeholders::_1));
+        });
+        if (unique) {
+            conn->forceClose();
+        }
+    } else {
+        connector_->stop();
+    }
+}
+
+void TcpClient::connect() {
+    RTCLOG(RTC_INFO, "TcpClient::connect[%s] - connecting to %s",
+           name_.c_str(), connector_->serverAddress().toIpPort().c_str());
+    connect_ = true;
+    connector_->start();
+}
+
+void TcpClient::disconnect() {
+    connect_ = false;
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (connection_) {
+        connection_->shutdown();
+    }
+}
+
+void TcpClient::stop() {
+    connect_ = false;
+    connector_->stop();
+}
+
+void TcpClient::newConnection(int sockfd) {
+    loop_->assertInLoopThread();
+    InetAddress peerAddr(sockets::getPeerAddr(sockfd));
+    InetAddress localAddr(sockets::getLocalAddr(sockfd));
+    TcpConnectionPtr conn = std::allocate_shared<TcpConnection>(internal::PoolAllocator<TcpConnection>(),
+        loop_, nextConnId_++, connNamePrefix_, sockfd, localAddr, peerAddr);
+    conn->setConnectionCallback(connectionCallback_);
+    conn->setMessageCallback(messageCallback_);
+    conn->setWriteCompleteCallback(writeCompleteCallback_);
+    conn->setCloseCallback(std::bind(&TcpClient::removeConnection, this, std::placeholders::_1));
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        connection_ = conn;
+    }
+    conn->connectEstablished();
+}
+
+void TcpClient::removeConnection(const TcpConnectionPtr& conn) {
+    loop_->assertInLoopThread();
+    assert(loop_ == conn->getLoop());
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        assert(connection_ == conn);
+        connection_.reset();
+    }
+    loop_->queueInLoop(std::bind(&TcpConnection::connectDestroyed, conn));
+    if (retry_ && connect_) {
+        RTCLOG(RTC_INFO, "TcpClient::removeConnection[%s] - reconnecting to %s",
+               name_.c_str(), connector_->serverAddress().toIpPort().c_str());
+        connector_->restart();
+    }
+}
+
+} // namespace hvnetpp
@@ -2,7 +2,9 @@
 #include "hvnetpp/Channel.h"
 #include "hvnetpp/EventLoop.h"
 #include "hvnetpp/SocketsOps.h"
+#include "hvnetpp/TokenBucket.h"
 #include "rtclog.h"
+#include <algorithm>
 #include <cerrno>
 #include <cstring>
 #include <unistd.h>
@@ -18,17 +20,65 @@ TcpConnection::TcpConnection(EventLoop* loop,
                              const InetAddress& localAddr,
                              const InetAddress& peerAddr)
     : loop_(loop),
+      id_(0),
       name_(nameArg),
       state_(kConnecting),
-      channel_(new Channel(loop, sockfd)),
+      channel_(loop, sockfd),
       socketFd_(sockfd),
       localAddr_(localAddr),
       peerAddr_(peerAddr),
-      highWaterMark_(64*1024*1024) {
-    channel_->setReadCallback(std::bind(&TcpConnection::handleRead, this));
-    channel_->setWriteCallback(std::bind(&TcpConnection::handleWrite, this));
-    channel_->setCloseCallback(std::bind(&TcpConnection::handleClose, this));
-    channel_->setErrorCallback(std::bind(static_cast<void (TcpConnection::*)()>(&TcpConnection::handleError), this));
+      handlingMessage_(false),
+      messageCallbackPending_(false),
+      highWaterMark_(64*1024*1024),
+      txTimestamping_(false),
+      reading_(false),
+      readPauses_(0),
+      backPressureHigh_(0),
+      backPressureLow_(0),
+      backPressured_(false),
+      writeThrottled_(false),
+      contextType_(nullptr),
+      bytesReceived_(0),
+      bytesSent_(0) {
+    init();
+}
+
+TcpConnection::TcpConnection(EventLoop* loop,
+                             uint64_t id,
+                             const std::shared_ptr<const std::string>& namePrefix,
+                             int sockfd,
+                             const InetAddress& localAddr,
+                             const InetAddress& peerAddr)
+    : loop_(loop),
+      id_(id),
+      namePrefix_(namePrefix),
+      state_(kConnecting),
+      channel_(loop, sockfd),
+      socketFd_(sockfd),
+      localAddr_(localAddr),
+      peerAddr_(peerAddr),
+      handlingMessage_(false),
+      messageCallbackPending_(false),
+      highWaterMark_(64*1024*1024),
+      txTimestamping_(false),
+      reading_(false),
+      readPauses_(0),
+      backPressureHigh_(0),
+      backPressureLow_(0),
+      backPressured_(false),
+      writeThrottled_(false),
+      contextType_(nullptr),
+      bytesReceived_(0),
+      bytesSent_(0) {
+    init();
+}
+
+void TcpConnection::init() {
+    // Lambdas capturing only this fit std::function's inline storage.
+    channel_.setReadCallback([this]() { handleRead(); });
+    channel_.setWriteCallback([this]() { handleWrite(); });
+    channel_.setCloseCallback([this]() { handleClose(); });
+    channel_.setErrorCallback([this]() { handleError(); });
 }
 
 TcpConnection::~TcpConnection() {
@@ -36,41 +86,113 @@ TcpConnection::~TcpConnection() {
     closeSocket();
 }
 
+void TcpConnection::setMessageCallback(const MessageCallback& cb) {
+    if (handlingMessage_) {
+        pendingMessageCallback_ = cb;
+        messageCallbackPending_ = true;
+    } else {
+        messageCallback_ = cb;
+    }
+}
+
+const std::string& TcpConnection::name() const {
+    std::call_once(nameOnce_, [this]() {
+        if (namePrefix_) {
+            name_ = *namePrefix_ + "#" + std::to_string(id_);
+        }
+    });
+    return name_;
+}
+
 void TcpConnection::connectEstablished() {
-    loop_->assertInLoopThread();
+    getLoop()->assertInLoopThread();
     assert(state() == kConnecting);
     setState(kConnected);
-    channel_->tie(shared_from_this());
-    channel_->enableReading();
+    reading_ = true;
+    updateReadingInLoop();
+    TcpConnectionPtr guardThis(shared_from_this());
     if (connectionCallback_) {
-        connectionCallback_(shared_from_this());
+        connectionCallback_(guardThis);
+    }
+    // Buffers restored by a hot restart.
+    if (outputBuffer_.readableBytes() > 0 && state() == kConnected && !channel_.isWriting()) {
+        channel_.enableWriting();
+    }
+    if (inputBuffer_.readableBytes() > 0 && state() == kConnected) {
+        dispatchMessage(guardThis);
+    }
+}
+
+void TcpConnection::dispatchMessage(const TcpConnectionPtr& guardThis) {
+    if (messageCallback_) {
+        handlingMessage_ = true;
+        messageCallback_(guardThis, &inputBuffer_);
+        handlingMessage_ = false;
+        if (messageCallbackPending_) {
+            messageCallback_.swap(pendingMessageCallback_);
+            pendingMessageCallback_ = MessageCallback();
+            messageCallbackPending_ = false;
+        }
     }
 }
 
+bool TcpConnection::handOffSocket(const SocketSender& send) {
+    getLoop()->assertInLoopThread();
+    // Send first so a failure leaves the connection untouched.
+    if (!send(socketFd_, inputBuffer_, outputBuffer_)) {
+        return false;
+    }
+    if (state() != kDisconnected) {
+        setState(kDisconnected);
+        channel_.disableAll();
+        releaseBackPressureInLoop();
+    }
+    channel_.remove();
+    inputBuffer_.retrieveAll();
+    outputBuffer_.retrieveAll();
+    closeSocket();
+    return true;
+}
+
+void TcpConnection::restoreBuffers(Buffer* input, Buffer* output) {
+    getLoop()->assertInLoopThread();
+    assert(state() == kConnecting);
+    inputBuffer_.swap(*input);
+    outputBuffer_.swap(*output);
+}
+
 void TcpConnection::connectDestroyed() {
-    loop_->assertInLoopThread();
+    if (!inOwnerLoop(&TcpConnection::connectDestroyed)) {
+        return;
+    }
     if (state() != kDisconnected) {
         setState(kDisconnected);
-        channel_->disableAll();
+        channel_.disableAll();
+        releaseBackPressureInLoop();
         if (connectionCallback_) {
             connectionCallback_(shared_from_this());
         }
     }
-    channel_->remove();
+    channel_.remove();
     closeSocket();
 }
 
 void TcpConnection::handleRead() {
-    loop_->assertInLoopThread();
+    getLoop()->assertInLoopThread();
     if (state() == kDisconnected) {
         return;
     }
     int savedErrno = 0;
-    ssize_t n = inputBuffer_.readFd(channel_->fd(), &savedErrno);
+    ssize_t n = inputBuffer_.readFd(channel_.fd(), &savedErrno);
     if (n > 0) {
-        if (messageCallback_) {
-            messageCallback_(shared_from_this(), &inputBuffer_);
+        bytesReceived_ += n;
+        if (readLimiter_) {
+            readLimiter_->consume(n);
+            if (readLimiter_->available() == 0) {
+                throttleReadInLoop();
+            }
         }
+        dispatchMessage(shared_from_this());
     } else if (n == 0) {
         handleClose();
     } else {
@@ -79,18 +201,28 @@ void TcpConnection::handleRead() {
 }
 
 void TcpConnection::handleWrite() {
-    loop_->assertInLoopThread();
+    getLoop()->assertInLoopThread();
     if (state() == kDisconnected) {
         return;
     }
-    if (channel_->isWriting()) {
-        ssize_t n = ::write(channel_->fd(), outputBuffer_.peek(), outputBuffer_.readableBytes());
+    if (channel_.isWriting()) {
+        const size_t len = writeQuota(outputBuffer_.readableBytes());
+        if (len == 0) {
+            throttleWriteInLoop();
+            return;
+        }
+        ssize_t n = ::write(channel_.fd(), outputBuffer_.peek(), len);
         if (n > 0) {
+            bytesSent_ += n;
+            consumeWriteQuota(n);
             outputBuffer_.retrieve(n);
+            if (backPressured_ && outputBuffer_.readableBytes() <= backPressureLow_) {
+                releaseBackPressureInLoop();
+            }
             if (outputBuffer_.readableBytes() == 0) {
-                channel_->disableWriting();
+                channel_.disableWriting();
                 if (writeCompleteCallback_) {
-                    loop_->queueInLoop(std::bind(writeCompleteCallback_, shared_from_this()));
+                    getLoop()->queueInLoop(std::bind(&TcpConnection::writeCompleteInLoop, shared_from_this()));
                 }
                 if (state() == kDisconnecting) {
                     shutdownInLoop();
@@ -103,10 +235,11 @@ void TcpConnection::handleWrite() {
 }
 
 void TcpConnection::handleClose() {
-    loop_->assertInLoopThread();
+    getLoop()->assertInLoopThread();
     assert(state() == kConnected || state() == kDisconnecting);
     setState(kDisconnected);
-    channel_->disableAll();
+    channel_.disableAll();
+    releaseBackPressureInLoop();
 
     TcpConnectionPtr guardThis(shared_from_this());
     if (connectionCallback_) {
@@ -117,8 +250,35 @@ void TcpConnection::handleClose() {
     }
 }
 
+void TcpConnection::setTxTimestampCallback(const TxTimestampCallback& cb) {
+    getLoop()->assertInLoopThread();
+    if (socketFd_ >= 0) {
+        if (cb) {
+            if (!sockets::enableTxTimestamps(socketFd_)) {
+                return;
+            }
+            txTimestamping_ = true;
+        } else if (txTimestamping_) {
+            sockets::disableTimestamps(socketFd_);
+        }
+    }
+    txTimestampCallback_ = cb;
+}
+
 void TcpConnection::handleError() {
-    int err = sockets::getSocketError(channel_->fd());
+    // Timestamps arrive on the error queue and raise EPOLLERR. Reports of
+    // sends made before the callback was cleared still have to be drained,
+    // or the level-triggered EPOLLERR never goes away.
+    if (txTimestamping_) {
+        TcpConnectionPtr guardThis(shared_from_this());
+        sockets::TxTimestamp ts;
+        while (sockets::readTxTimestamp(socketFd_, &ts)) {
+            if (txTimestampCallback_) {
+                txTimestampCallback_(guardThis, ts);
+            }
+        }
+    }
+    int err = sockets::getSocketError(channel_.fd());
     if (err != 0) {
         handleError(err);
     }
@@ -128,41 +288,101 @@ void TcpConnection::handleError(int err) {
     if (err == 0 || err == EAGAIN || err == EWOULDBLOCK || err == EINTR) {
         return;
     }
-    RTCLOG(RTC_ERROR, "TcpConnection::handleError name=%s - error=%d: %s", name_.c_str(), err, strerror(err));
+    RTCLOG(RTC_ERROR, "TcpConnection::handleError name=%s - error=%d: %s", name().c_str(), err, strerror(err));
     if (state() == kConnected || state() == kDisconnecting) {
         handleClose();
     }
 }
 
 void TcpConnection::send(const std::string& message) {
-    if (loop_->isInLoopThread()) {
+    if (getLoop()->isInLoopThread()) {
         if (state() == kConnected) {
             sendInLoop(message);
         }
     } else if (state() == kConnected) {
-        TcpConnectionPtr self(shared_from_this());
-        loop_->queueInLoop([self, message]() {
-            if (self->state() == kConnected) {
-                self->sendInLoop(message);
-            }
-        });
+        getLoop()->queueInLoop(std::bind(&TcpConnection::sendStringInLoop, shared_from_this(), message));
     }
 }
 
 void TcpConnection::send(Buffer* buf) {
-    if (loop_->isInLoopThread()) {
+    if (getLoop()->isInLoopThread()) {
         if (state() == kConnected) {
             sendInLoop(buf->peek(), buf->readableBytes());
             buf->retrieveAll();
         }
     } else if (state() == kConnected) {
-        std::string message = buf->retrieveAllAsString();
-        TcpConnectionPtr self(shared_from_this());
-        loop_->queueInLoop([self, message]() {
-            if (self->state() == kConnected) {
-                self->sendInLoop(message);
-            }
-        });
+        Buffer message;
+        message.swap(*buf);
+        getLoop()->queueInLoop(std::bind(&TcpConnection::sendBufferInLoop, shared_from_this(), std::move(message)));
+    }
+}
+
+void TcpConnection::send(std::string&& message) {
+    if (getLoop()->isInLoopThread()) {
+        if (state() == kConnected) {
+            sendInLoop(message);
+        }
+    } else if (state() == kConnected) {
+        getLoop()->queueInLoop(std::bind(&TcpConnection::sendStringInLoop, shared_from_this(), std::move(message)));
+    }
+}
+
+void TcpConnection::send(Buffer&& buf) {
+    send(&buf);
+}
+
+void TcpConnection::send(std::unique_ptr<Buffer> buf) {
+    if (!buf) {
+        return;
+    }
+    if (getLoop()->isInLoopThread()) {
+        if (state() == kConnected) {
+            sendInLoop(buf->peek(), buf->readableBytes());
+        }
+    } else if (state() == kConnected) {
+        // buf dies right after, so its moved-from state never gets used.
+        getLoop()->queueInLoop(std::bind(&TcpConnection::sendBufferInLoop, shared_from_this(), std::move(*buf)));
+    }
+}
+
+// The payload is owned by the queued closure and used once, so a migration
+// forward moves it on instead of copying it.
+void TcpConnection::sendStringInLoop(std::string& message) {
+    if (!getLoop()->isInLoopThread()) {
+        getLoop()->queueInLoop(std::bind(&TcpConnection::sendStringInLoop, shared_from_this(), std::move(message)));
+        return;
+    }
+    if (state() == kConnected) {
+        sendInLoop(message.data(), message.size());
+    }
+}
+
+void TcpConnection::sendBufferInLoop(Buffer& message) {
+    if (!getLoop()->isInLoopThread()) {
+        getLoop()->queueInLoop(std::bind(&TcpConnection::sendBufferInLoop, shared_from_this(), std::move(message)));
+        return;
+    }
+    if (state() == kConnected) {
+        sendInLoop(message.peek(), message.readableBytes());
+    }
+}
+
+void TcpConnection::writeCompleteInLoop() {
+    if (!inOwnerLoop(&TcpConnection::writeCompleteInLoop)) {
+        return;
+    }
+    if (writeCompleteCallback_) {
+        writeCompleteCallback_(shared_from_this());
+    }
+}
+
+void TcpConnection::highWaterMarkInLoop(size_t len) {
+    if (!getLoop()->isInLoopThread()) {
+        getLoop()->queueInLoop(std::bind(&TcpConnection::highWaterMarkInLoop, shared_from_this(), len));
+        return;
+    }
+    if (highWaterMarkCallback_) {
+        highWaterMarkCallback_(shared_from_this(), len);
     }
 }
 
@@ -171,7 +391,7 @@ void TcpConnection::sendInLoop(const std::string& message) {
 }
 
 void TcpConnection::sendInLoop(const void* data, size_t len) {
-    loop_->assertInLoopThread();
+    getLoop()->assertInLoopThread();
     ssize_t nwrote = 0;
     size_t remaining = len;
     bool faultError = false;
@@ -181,12 +401,15 @@ void TcpConnection::sendInLoop(const void* data, size_t len) {
     }
 
     // if no thing in output queue, try write directly
-    if (!channel_->isWriting() && outputBuffer_.readableBytes() == 0) {
-        nwrote = ::write(channel_->fd(), data, len);
+    const size_t quota = writeQuota(len);
+    if (!channel_.isWriting() && !writeThrottled_ && outputBuffer_.readableBytes() == 0 && quota > 0) {
+        nwrote = ::write(channel_.fd(), data, quota);
         if (nwrote >= 0) {
+            bytesSent_ += nwrote;
+            consumeWriteQuota(nwrote);
             remaining = len - nwrote;
             if (remaining == 0 && writeCompleteCallback_) {
-                loop_->queueInLoop(std::bind(writeCompleteCallback_, shared_from_this()));
+                getLoop()->queueInLoop(std::bind(&TcpConnection::writeCompleteInLoop, shared_from_this()));
             }
         } else {
             const int savedErrno = errno;
@@ -204,39 +427,294 @@ void TcpConnection::sendInLoop(const void* data, size_t len) {
         if (oldLen + remaining >= highWaterMark_
             && oldLen < highWaterMark_
             && highWaterMarkCallback_) {
-            loop_->queueInLoop(std::bind(highWaterMarkCallback_, shared_from_this(), oldLen + remaining));
+            getLoop()->queueInLoop(std::bind(&TcpConnection::highWaterMarkInLoop, shared_from_this(), oldLen + remaining));
         }
         outputBuffer_.append(static_cast<const char*>(data) + nwrote, remaining);
-        if (!channel_->isWriting()) {
-            channel_->enableWriting();
+        if (!channel_.isWriting() && !writeThrottled_) {
+            channel_.enableWriting();
+        }
+        if (!backPressured_ && backPressureHigh_ > 0
+            && outputBuffer_.readableBytes() >= backPressureHigh_) {
+            applyBackPressureInLoop();
         }
     }
 }
 
 void TcpConnection::shutdown() {
-    if (loop_->isInLoopThread()) {
+    if (getLoop()->isInLoopThread()) {
         if (state() == kConnected) {
             setState(kDisconnecting);
             shutdownInLoop();
         }
     } else if (state() == kConnected) {
-        TcpConnectionPtr self(shared_from_this());
-        loop_->queueInLoop([self]() {
-            if (self->state() == kConnected) {
-                self->setState(kDisconnecting);
-                self->shutdownInLoop();
-            }
-        });
+        getLoop()->queueInLoop(std::bind(&TcpConnection::startShutdownInLoop, shared_from_this()));
+    }
+}
+
+void TcpConnection::startShutdownInLoop() {
+    if (!inOwnerLoop(&TcpConnection::startShutdownInLoop)) {
+        return;
+    }
+    if (state() == kConnected) {
+        setState(kDisconnecting);
+        shutdownInLoop();
     }
 }
 
 void TcpConnection::shutdownInLoop() {
-    loop_->assertInLoopThread();
-    if (socketFd_ >= 0 && !channel_->isWriting()) {
+    getLoop()->assertInLoopThread();
+    if (socketFd_ >= 0 && !channel_.isWriting() && !writeThrottled_) {
         sockets::shutdownWrite(socketFd_);
     }
 }
 
+void TcpConnection::forceClose() {
+    if (state() == kConnected || state() == kDisconnecting) {
+        setState(kDisconnecting);
+        getLoop()->queueInLoop(std::bind(&TcpConnection::forceCloseInLoop, shared_from_this()));
+    }
+}
+
+void TcpConnection::forceCloseInLoop() {
+    if (!inOwnerLoop(&TcpConnection::forceCloseInLoop)) {
+        return;
+    }
+    if (state() == kConnected || state() == kDisconnecting) {
+        handleClose();
+    }
+}
+
+void TcpConnection::startRead() {
+    getLoop()->runInLoop(std::bind(&TcpConnection::startReadInLoop, shared_from_this()));
+}
+
+void TcpConnection::stopRead() {
+    getLoop()->runInLoop(std::bind(&TcpConnection::stopReadInLoop, shared_from_this()));
+}
+
+void TcpConnection::startReadInLoop() {
+    if (!inOwnerLoop(&TcpConnection::startReadInLoop)) {
+        return;
+    }
+    reading_ = true;
+    updateReadingInLoop();
+}
+
+void TcpConnection::stopReadInLoop() {
+    if (!inOwnerLoop(&TcpConnection::stopReadInLoop)) {
+        return;
+    }
+    reading_ = false;
+    updateReadingInLoop();
+}
+
+void TcpConnection::pauseReadInLoop() {
+    if (!inOwnerLoop(&TcpConnection::pauseReadInLoop)) {
+        return;
+    }
+    ++readPauses_;
+    updateReadingInLoop();
+}
+
+void TcpConnection::resumeReadInLoop() {
+    if (!inOwnerLoop(&TcpConnection::resumeReadInLoop)) {
+        return;
+    }
+    assert(readPauses_ > 0);
+    --readPauses_;
+    updateReadingInLoop();
+}
+
+// The channel reads only when the user wants it to and no linked sink is
+// above its high mark.
+void TcpConnection::updateReadingInLoop() {
+    if (state() != kConnected && state() != kDisconnecting) {
+        return;
+    }
+    const bool wantRead = reading_ && readPauses_ == 0;
+    if (wantRead && !channel_.isReading()) {
+        channel_.enableReading();
+    } else if (!wantRead && channel_.isReading()) {
+        channel_.disableReading();
+    }
+}
+
+void TcpConnection::setBackPressure(size_t highMark, size_t lowMark) {
+    assert(lowMark < highMark);
+    backPressureHigh_ = highMark;
+    backPressureLow_ = lowMark;
+}
+
+void TcpConnection::addBackPressureSource(const TcpConnectionPtr& source) {
+    getLoop()->runInLoop(std::bind(&TcpConnection::addBackPressureSourceInLoop, shared_from_this(),
+                                   std::weak_ptr<TcpConnection>(source)));
+}
+
+void TcpConnection::addBackPressureSourceInLoop(const std::weak_ptr<TcpConnection>& weakSource) {
+    if (!getLoop()->isInLoopThread()) {
+        getLoop()->queueInLoop(std::bind(&TcpConnection::addBackPressureSourceInLoop, shared_from_this(), weakSource));
+        return;
+    }
+    backPressureSources_.push_back(weakSource);
+    if (backPressured_) {
+        TcpConnectionPtr src = weakSource.lock();
+        if (src) {
+            src->getLoop()->runInLoop(std::bind(&TcpConnection::pauseReadInLoop, src));
+        }
+    }
+}
+
+void TcpConnection::applyBackPressureInLoop() {
+    getLoop()->assertInLoopThread();
+    backPressured_ = true;
+    for (const auto& weakSource : backPressureSources_) {
+        TcpConnectionPtr src = weakSource.lock();
+        if (src) {
+            src->getLoop()->runInLoop(std::bind(&TcpConnection::pauseReadInLoop, src));
+        }
+    }
+}
+
+void TcpConnection::releaseBackPressureInLoop() {
+    getLoop()->assertInLoopThread();
+    if (!backPressured_) {
+        return;
+    }
+    backPressured_ = false;
+    for (const auto& weakSource : backPressureSources_) {
+        TcpConnectionPtr src = weakSource.lock();
+        if (src) {
+            src->getLoop()->runInLoop(std::bind(&TcpConnection::resumeReadInLoop, src));
+        }
+    }
+}
+
+void TcpConnection::setReadRateLimit(double bytesPerSecond, size_t burst) {
+    if (bytesPerSecond > 0.0) {
+        readLimiter_ = std::make_shared<TokenBucket>(bytesPerSecond, burst);
+    } else {
+        readLimiter_.reset();
+    }
+}
+
+void TcpConnection::setWriteRateLimit(double bytesPerSecond, size_t burst) {
+    if (bytesPerSecond > 0.0) {
+        writeLimiter_ = std::make_shared<TokenBucket>(bytesPerSecond, burst);
+    } else {
+        writeLimiter_.reset();
+    }
+}
+
+size_t TcpConnection::writeQuota(size_t len) {
+    if (writeLimiter_) {
+        len = std::min(len, writeLimiter_->available());
+    }
+    if (sharedWriteLimiter_) {
+        len = std::min(len, sharedWriteLimiter_->available());
+    }
+    return len;
+}
+
+void TcpConnection::consumeWriteQuota(size_t len) {
+    if (writeLimiter_) {
+        writeLimiter_->consume(len);
+    }
+    if (sharedWriteLimiter_) {
+        sharedWriteLimiter_->consume(len);
+    }
+}
+
+// Reuses the back-pressure pause count, so rate limiting composes with
+// stopRead() and linked sinks.
+void TcpConnection::throttleReadInLoop() {
+    getLoop()->assertInLoopThread();
+    pauseReadInLoop();
+    std::weak_ptr<TcpConnection> weakSelf(shared_from_this());
+    getLoop()->runAfter(readLimiter_->refillDelay(), [weakSelf]() {
+        TcpConnectionPtr self = weakSelf.lock();
+        if (self) {
+            self->resumeReadInLoop();
+        }
+    });
+}
+
+void TcpConnection::throttleWriteInLoop() {
+    getLoop()->assertInLoopThread();
+    writeThrottled_ = true;
+    channel_.disableWriting();
+    double delay = 0.0;
+    if (writeLimiter_) {
+        delay = writeLimiter_->refillDelay();
+    }
+    if (sharedWriteLimiter_) {
+        delay = std::max(delay, sharedWriteLimiter_->refillDelay());
+    }
+    std::weak_ptr<TcpConnection> weakSelf(shared_from_this());
+    getLoop()->runAfter(delay, [weakSelf]() {
+        TcpConnectionPtr self = weakSelf.lock();
+        if (self) {
+            self->resumeWriteInLoop();
+        }
+    });
+}
+
+void TcpConnection::resumeWriteInLoop() {
+    if (!inOwnerLoop(&TcpConnection::resumeWriteInLoop)) {
+        return;
+    }
+    writeThrottled_ = false;
+    if ((state() == kConnected || state() == kDisconnecting)
+        && outputBuffer_.readableBytes() > 0 && !channel_.isWriting()) {
+        channel_.enableWriting();
+    }
+}
+
+void TcpConnection::migrateTo(EventLoop* target) {
+    getLoop()->queueInLoop(std::bind(&TcpConnection::migrateInLoop, shared_from_this(), target));
+}
+
+void TcpConnection::migrateInLoop(EventLoop* target) {
+    EventLoop* loop = getLoop();
+    if (!loop->isInLoopThread()) {
+        loop->queueInLoop(std::bind(&TcpConnection::migrateInLoop, shared_from_this(), target));
+        return;
+    }
+    if (target == loop || (state() != kConnected && state() != kDisconnecting)) {
+        return;
+    }
+    // Buffers, limiters and back-pressure state move with the object; only
+    // the poller registration changes hands. Anything still queued on the old
+    // loop is forwarded by inOwnerLoop().
+    const bool writing = channel_.isWriting();
+    channel_.disableAll();
+    channel_.remove();
+    channel_.setOwnerLoop(target);
+    loop_.store(target, std::memory_order_release);
+    target->queueInLoop(std::bind(&TcpConnection::attachInLoop, shared_from_this(), writing));
+}
+
+void TcpConnection::attachInLoop(bool writing) {
+    getLoop()->assertInLoopThread();
+    if (state() != kConnected && state() != kDisconnecting) {
+        return;
+    }
+    if (writing && !writeThrottled_ && !channel_.isWriting()) {
+        channel_.enableWriting();
+    }
+    updateReadingInLoop();
+}
+
+// A functor queued before migrateTo() may run on the old loop; forward it
+// to the current one.
+bool TcpConnection::inOwnerLoop(void (TcpConnection::*method)()) {
+    EventLoop* loop = getLoop();
+    if (loop->isInLoopThread()) {
+        return true;
+    }
+    loop->queueInLoop(std::bind(method, shared_from_this()));
+    return false;
+}
+
 void TcpConnection::setTcpNoDelay(bool on) {
     if (socketFd_ >= 0) {
         sockets::setTcpNoDelay(socketFd_, on);
@@ -3,36 +3,96 @@
 #include "hvnetpp/Channel.h"
 #include "hvnetpp/SocketsOps.h"
 #include "hvnetpp/InetAddress.h"
+#include "hvnetpp/PoolAllocator.h"
+#include "hvnetpp/TokenBucket.h"
+#include "rtclog.h"
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <arpa/inet.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <assert.h>
 #include <cerrno>
-#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
 
 namespace hvnetpp {
 
+namespace {
+
+// Removes a socket file left behind by a server that is gone. Anything else
+// at the path, or a socket someone still listens on, is left for bind to
+// fail on.
+void removeStaleUnixSocket(const InetAddress& addr) {
+    const struct sockaddr_un* un = reinterpret_cast<const struct sockaddr_un*>(addr.getSockAddr());
+    struct stat st;
+    if (un->sun_path[0] == '\0' || ::lstat(un->sun_path, &st) != 0 || !S_ISSOCK(st.st_mode)) {
+        return;
+    }
+    // Nonblocking, so a live server with a full backlog gives EAGAIN.
+    int probe = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (probe < 0) {
+        return;
+    }
+    int ret = ::connect(probe, addr.getSockAddr(), addr.getSockAddrLen());
+    int savedErrno = errno;
+    ::close(probe);
+    if (ret < 0 && savedErrno == ECONNREFUSED) {
+        ::unlink(un->sun_path);
+    }
+}
+
+// Like bindOrDie, a server that can't have the address it was given stops
+// here, e.g. for a Unix path fromUnixPath() couldn't fit.
+int createListenSocketOrDie(const InetAddress& listenAddr) {
+    if (!listenAddr.valid()) {
+        RTCLOG(RTC_FATAL, "TcpServer listen address is invalid");
+        abort();
+    }
+    return sockets::createNonblockingOrDie(listenAddr.family());
+}
+
+} // namespace
+
 // Internal Acceptor class
-class Acceptor : public std::enable_shared_from_this<Acceptor> {
+class Acceptor {
 public:
     using NewConnectionCallback = std::function<void(int sockfd, const InetAddress&)>;
 
     Acceptor(EventLoop* loop, const InetAddress& listenAddr, bool reuseport)
         : loop_(loop),
-          acceptSocket_(sockets::createNonblockingOrDie(listenAddr.family())),
+          acceptSocket_(createListenSocketOrDie(listenAddr)),
           acceptChannel_(std::make_shared<Channel>(loop, acceptSocket_)),
           listening_(false),
           idleFd_(::open("/dev/null", O_RDONLY | O_CLOEXEC)) {
         
         assert(idleFd_ >= 0);
-        sockets::setReuseAddr(acceptSocket_, true);
-        sockets::setReusePort(acceptSocket_, reuseport);
+        if (listenAddr.isUnix()) {
+            // A stale socket file from a previous run would make bind fail.
+            removeStaleUnixSocket(listenAddr);
+        } else {
+            sockets::setReuseAddr(acceptSocket_, true);
+            sockets::setReusePort(acceptSocket_, reuseport);
+        }
         sockets::bindOrDie(acceptSocket_, listenAddr.getSockAddr());
         
         acceptChannel_->setReadCallback(std::bind(&Acceptor::handleRead, this));
     }
 
+    // Adopts a socket that is already bound, e.g. one inherited through a
+    // hot restart.
+    Acceptor(EventLoop* loop, int listenFd)
+        : loop_(loop),
+          acceptSocket_(listenFd),
+          acceptChannel_(std::make_shared<Channel>(loop, acceptSocket_)),
+          listening_(false),
+          idleFd_(::open("/dev/null", O_RDONLY | O_CLOEXEC)) {
+        assert(idleFd_ >= 0);
+        acceptChannel_->setReadCallback(std::bind(&Acceptor::handleRead, this));
+    }
+
     ~Acceptor() {
         std::shared_ptr<Channel> acceptChannel = std::move(acceptChannel_);
         if (acceptChannel) {
@@ -55,15 +115,19 @@ public:
         newConnectionCallback_ = cb;
     }
 
+    int fd() const { return acceptSocket_; }
+
+    // ~Acceptor may run from a callback of the same poll round, e.g.
+    // handOff(); the queued channel would then still dispatch to us.
     void tieChannel() {
-        acceptChannel_->tie(shared_from_this());
+        acceptChannel_->tie(liveness_);
     }
 
 private:
     void handleRead() {
         loop_->assertInLoopThread();
         while (true) {
-            struct sockaddr_in6 peerAddr;
+            struct sockaddr_storage peerAddr;
             int connfd = sockets::accept(acceptSocket_, &peerAddr);
             if (connfd >= 0) {
                 if (newConnectionCallback_) {
@@ -95,12 +159,106 @@ private:
     NewConnectionCallback newConnectionCallback_;
     bool listening_;
     int idleFd_;
+    LivenessGuard liveness_;
+};
+
+namespace {
+
+// Hot restart stream: a HandoffRecord per fd, the fd riding on the record's first
+// byte, followed by the connection's input and output bytes.
+struct HandoffRecord {
+    enum Type : uint32_t { kListener = 1, kConnection = 2, kEnd = 3 };
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t inputLen;
+    uint64_t outputLen;
 };
 
+bool writeFull(int fd, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = ::write(fd, data, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool readFull(int fd, char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = ::read(fd, data, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool readFull(int fd, Buffer* buf, size_t len) {
+    buf->ensureWritableBytes(len);
+    if (!readFull(fd, buf->beginWrite(), len)) {
+        return false;
+    }
+    buf->hasWritten(len);
+    return true;
+}
+
+bool sendRecord(int unixSockfd, const HandoffRecord& record, int fd) {
+    if (fd < 0) {
+        return writeFull(unixSockfd, reinterpret_cast<const char*>(&record), sizeof record);
+    }
+    ssize_t n = sockets::sendFds(unixSockfd, &fd, 1, &record, sizeof record);
+    return n > 0 && writeFull(unixSockfd, reinterpret_cast<const char*>(&record) + n, sizeof record - n);
+}
+
+// Sets *fd to the fd carried by the record, or -1 if none.
+bool recvRecord(int unixSockfd, HandoffRecord* record, int* fd) {
+    size_t nfds = 1;
+    ssize_t n = sockets::recvFds(unixSockfd, fd, &nfds, record, sizeof *record);
+    if (n <= 0) {
+        return false;
+    }
+    if (nfds == 0) {
+        *fd = -1;
+    }
+    return readFull(unixSockfd, reinterpret_cast<char*>(record) + n, sizeof *record - n);
+}
+
+} // namespace
+
 TcpServer::TcpServer(EventLoop* loop, const InetAddress& listenAddr, const std::string& nameArg)
     : loop_(loop),
+      ipPort_(listenAddr.toIpPort()),
       name_(nameArg),
+      connNamePrefix_(std::make_shared<const std::string>(name_ + "-" + ipPort_)),
       acceptor_(std::make_shared<Acceptor>(loop, listenAddr, true)),
+      readRateLimit_(0.0),
+      writeRateLimit_(0.0),
+      rateLimitBurst_(0),
+      nextConnId_(1) {
+    acceptor_->tieChannel();
+    acceptor_->setNewConnectionCallback(std::bind(&TcpServer::newConnection, this, std::placeholders::_1, std::placeholders::_2));
+}
+
+TcpServer::TcpServer(EventLoop* loop, int listenFd, const std::string& nameArg)
+    : loop_(loop),
+      ipPort_(InetAddress(sockets::getLocalAddr(listenFd)).toIpPort()),
+      name_(nameArg),
+      connNamePrefix_(std::make_shared<const std::string>(name_ + "-" + ipPort_)),
+      acceptor_(std::make_shared<Acceptor>(loop, listenFd)),
+      readRateLimit_(0.0),
+      writeRateLimit_(0.0),
+      rateLimitBurst_(0),
       nextConnId_(1) {
     acceptor_->tieChannel();
     acceptor_->setNewConnectionCallback(std::bind(&TcpServer::newConnection, this, std::placeholders::_1, std::placeholders::_2));
@@ -108,33 +266,156 @@ TcpServer::TcpServer(EventLoop* loop, const InetAddress& listenAddr, const std::
 
 TcpServer::~TcpServer() {
     loop_->assertInLoopThread();
-    for (auto& item : connections_) {
-        TcpConnectionPtr conn(item.second);
-        item.second.reset();
+    connections_.forEach([](uint64_t, TcpConnectionPtr& item) {
+        TcpConnectionPtr conn(item);
+        item.reset();
         conn->getLoop()->runInLoop(std::bind(&TcpConnection::connectDestroyed, conn));
-    }
+    });
 }
 
 void TcpServer::start() {
+    assert(acceptor_);
     loop_->runInLoop(std::bind(&Acceptor::listen, acceptor_.get()));
 }
 
+bool TcpServer::handOff(int unixSockfd, bool includeConnections, size_t* transferred) {
+    loop_->assertInLoopThread();
+    if (!acceptor_) {
+        return false;
+    }
+    HandoffRecord record = { HandoffRecord::kListener, 0, 0, 0 };
+    if (!sendRecord(unixSockfd, record, acceptor_->fd())) {
+        RTCLOG(RTC_ERROR, "TcpServer::handOff [%s] failed to send listener: %s", name_.c_str(), strerror(errno));
+        return false;
+    }
+    // The peer now shares the listen queue; stop accepting here.
+    acceptor_.reset();
+
+    bool ok = true;
+    size_t sent = 0;
+    if (includeConnections) {
+        ConnectionMap connections;
+        std::swap(connections, connections_);
+        connections.forEach([&](uint64_t connId, const TcpConnectionPtr& conn) {
+            if (!ok || conn->getLoop() != loop_) {
+                // Owned by another loop thread, or the stream broke: keep serving it.
+                connections_.insert(connId, conn);
+                return;
+            }
+            ok = conn->handOffSocket([&](int sockfd, const Buffer& input, const Buffer& output) {
+                record.type = HandoffRecord::kConnection;
+                record.inputLen = input.readableBytes();
+                record.outputLen = output.readableBytes();
+                return sendRecord(unixSockfd, record, sockfd)
+                    && writeFull(unixSockfd, input.peek(), input.readableBytes())
+                    && writeFull(unixSockfd, output.peek(), output.readableBytes());
+            });
+            if (!ok) {
+                // The peer drops a partial record; the connection was never
+                // released, so it carries on here as if nothing happened.
+                connections_.insert(connId, conn);
+                return;
+            }
+            ++sent;
+            // Handed-off connections are down as far as this process goes.
+            if (connectionCallback_) {
+                connectionCallback_(conn);
+            }
+        });
+    }
+    if (transferred) {
+        *transferred = sent;
+    }
+    record = { HandoffRecord::kEnd, 0, 0, 0 };
+    if (ok) {
+        ok = sendRecord(unixSockfd, record, -1);
+    }
+    if (!ok) {
+        RTCLOG(RTC_ERROR, "TcpServer::handOff [%s] failed: %s", name_.c_str(), strerror(errno));
+    }
+    return ok;
+}
+
+int TcpServer::receiveListenFd(int unixSockfd) {
+    HandoffRecord record;
+    int fd = -1;
+    if (!recvRecord(unixSockfd, &record, &fd) || record.type != HandoffRecord::kListener || fd < 0) {
+        RTCLOG(RTC_ERROR, "TcpServer::receiveListenFd no listener received");
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        return -1;
+    }
+    return fd;
+}
+
+size_t TcpServer::adoptConnections(int unixSockfd) {
+    loop_->assertInLoopThread();
+    size_t adopted = 0;
+    while (true) {
+        HandoffRecord record;
+        int sockfd = -1;
+        if (!recvRecord(unixSockfd, &record, &sockfd)) {
+            RTCLOG(RTC_ERROR, "TcpServer::adoptConnections [%s] stream ended early", name_.c_str());
+            break;
+        }
+        if (record.type == HandoffRecord::kEnd) {
+            break;
+        }
+        Buffer input;
+        Buffer output;
+        if (record.type != HandoffRecord::kConnection || sockfd < 0
+            || !readFull(unixSockfd, &input, record.inputLen)
+            || !readFull(unixSockfd, &output, record.outputLen)) {
+            RTCLOG(RTC_ERROR, "TcpServer::adoptConnections [%s] bad record", name_.c_str());
+            if (sockfd >= 0) {
+                ::close(sockfd);
+            }
+            break;
+        }
+        establishConnection(sockfd, InetAddress(sockets::getPeerAddr(sockfd)), &input, &output);
+        ++adopted;
+    }
+    return adopted;
+}
+
+void TcpServer::setConnectionRateLimit(double readBytesPerSecond, double writeBytesPerSecond, size_t burst) {
+    readRateLimit_ = readBytesPerSecond;
+    writeRateLimit_ = writeBytesPerSecond;
+    rateLimitBurst_ = burst;
+}
+
+void TcpServer::setTotalWriteRateLimit(double bytesPerSecond, size_t burst) {
+    if (bytesPerSecond > 0.0) {
+        totalWriteLimiter_ = std::make_shared<TokenBucket>(bytesPerSecond, burst);
+    } else {
+        totalWriteLimiter_.reset();
+    }
+}
+
 void TcpServer::newConnection(int sockfd, const InetAddress& peerAddr) {
+    establishConnection(sockfd, peerAddr, nullptr, nullptr);
+}
+
+void TcpServer::establishConnection(int sockfd, const InetAddress& peerAddr, Buffer* input, Buffer* output) {
     loop_->assertInLoopThread();
-    char buf[64];
-    snprintf(buf, sizeof buf, "-%s#%d", name_.c_str(), nextConnId_);
-    ++nextConnId_;
-    std::string connName = name_ + buf;
+    const uint64_t connId = nextConnId_++;
 
-    struct sockaddr_in6 local = sockets::getLocalAddr(sockfd);
-    InetAddress localAddr(local);
+    InetAddress localAddr(sockets::getLocalAddr(sockfd));
 
-    TcpConnectionPtr conn(new TcpConnection(loop_, connName, sockfd, localAddr, peerAddr));
-    connections_[connName] = conn;
+    TcpConnectionPtr conn = std::allocate_shared<TcpConnection>(internal::PoolAllocator<TcpConnection>(),
+        loop_, connId, connNamePrefix_, sockfd, localAddr, peerAddr);
+    connections_.insert(connId, conn);
     conn->setConnectionCallback(connectionCallback_);
     conn->setMessageCallback(messageCallback_);
     conn->setWriteCompleteCallback(writeCompleteCallback_);
+    conn->setReadRateLimit(readRateLimit_, rateLimitBurst_);
+    conn->setWriteRateLimit(writeRateLimit_, rateLimitBurst_);
+    conn->setSharedWriteLimiter(totalWriteLimiter_);
     conn->setCloseCallback(std::bind(&TcpServer::removeConnection, this, std::placeholders::_1));
+    if (input && output) {
+        conn->restoreBuffers(input, output);
+    }
     
     loop_->runInLoop(std::bind(&TcpConnection::connectEstablished, conn));
 }
@@ -145,9 +426,11 @@ void TcpServer::removeConnection(const TcpConnectionPtr& conn) {
 
 void TcpServer::removeConnectionInLoop(const TcpConnectionPtr& conn) {
     loop_->assertInLoopThread();
-    size_t n = connections_.erase(conn->name());
-    assert(n == 1);
-    loop_->queueInLoop(std::bind(&TcpConnection::connectDestroyed, conn));
+    bool erased = connections_.erase(conn->id());
+    assert(erased);
+    (void)erased;
+    // The connection may have been migrated to another loop.
+    conn->getLoop()->queueInLoop(std::bind(&TcpConnection::connectDestroyed, conn));
 }
 
 } // namespace hvnetpp
@@ -0,0 +1,38 @@
+#include "hvnetpp/TimingWheel.h"
+#include "hvnetpp/EventLoop.h"
+
+namespace hvnetpp {
+
+TimingWheel::TimingWheel(EventLoop* loop, size_t slots, double tickSeconds, ExpireCallback cb)
+    : loop_(loop),
+      expireCallback_(std::move(cb)),
+      buckets_(slots < 2 ? 2 : slots),
+      now_(0) {
+    timer_ = loop_->runEvery(tickSeconds, [this]() { tick(); });
+}
+
+TimingWheel::~TimingWheel() {
+    loop_->assertInLoopThread();
+    loop_->cancel(timer_);
+}
+
+void TimingWheel::schedule(uint64_t id, uint32_t ticks) {
+    if (ticks < 1) {
+        ticks = 1;
+    } else if (ticks > buckets_.size() - 1) {
+        ticks = static_cast<uint32_t>(buckets_.size() - 1);
+    }
+    buckets_[(now_ + ticks) % buckets_.size()].push_back(id);
+}
+
+void TimingWheel::tick() {
+    ++now_;
+    // Swap so callbacks may schedule into this very bucket again.
+    firing_.swap(buckets_[now_ % buckets_.size()]);
+    for (uint64_t id : firing_) {
+        expireCallback_(id);
+    }
+    firing_.clear();
+}
+
+} // namespace hvnetpp
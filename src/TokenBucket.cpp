@@ -0,0 +1,69 @@
+#include "hvnetpp/TokenBucket.h"
+#include <algorithm>
+#include <assert.h>
+#include <cstdint>
+
+namespace hvnetpp {
+
+namespace {
+
+const size_t kMaxDefaultBurst = SIZE_MAX / 2;
+
+// A zero burst would never admit a byte; give it one second's worth.
+// Clamp while still a double: converting an out-of-range, infinite or NaN
+// rate to size_t is undefined.
+size_t effectiveBurst(double bytesPerSecond, size_t burst) {
+    if (burst > 0) {
+        return burst;
+    }
+    if (!(bytesPerSecond < static_cast<double>(kMaxDefaultBurst))) {
+        return kMaxDefaultBurst;
+    }
+    if (!(bytesPerSecond >= 1.0)) {
+        return 1;
+    }
+    return static_cast<size_t>(bytesPerSecond);
+}
+
+// Never sleep for less than this, and wait for at least this much refill,
+// so throttled connections don't spin on tiny writes.
+const double kMinRefillSeconds = 0.005;
+
+} // namespace
+
+TokenBucket::TokenBucket(double bytesPerSecond, size_t burst)
+    : rate_(bytesPerSecond),
+      burst_(effectiveBurst(bytesPerSecond, burst)),
+      tokens_(static_cast<double>(burst_)),
+      last_(std::chrono::steady_clock::now()) {
+    assert(rate_ > 0.0);
+}
+
+void TokenBucket::refill(Timestamp now) {
+    const double elapsed = std::chrono::duration<double>(now - last_).count();
+    last_ = now;
+    if (elapsed > 0.0) {
+        tokens_ = std::min(tokens_ + elapsed * rate_, static_cast<double>(burst_));
+    }
+}
+
+size_t TokenBucket::available() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    refill(std::chrono::steady_clock::now());
+    return tokens_ >= 1.0 ? static_cast<size_t>(tokens_) : 0;
+}
+
+void TokenBucket::consume(size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    tokens_ -= static_cast<double>(bytes);
+}
+
+double TokenBucket::refillDelay() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    refill(std::chrono::steady_clock::now());
+    const double target = std::min(rate_ * kMinRefillSeconds, static_cast<double>(burst_));
+    const double delay = (target - tokens_) / rate_;
+    return std::max(delay, kMinRefillSeconds);
+}
+
+} // namespace hvnetpp
@@ -0,0 +1,537 @@
+#include "hvnetpp/TurnServer.h"
+#include "hvnetpp/EventLoop.h"
+#include "hvnetpp/RtpPacket.h"
+#include "hvnetpp/SocketsOps.h"
+#include "hvnetpp/TimingWheel.h"
+#include "hvnetpp/UdpSocket.h"
+#include "rtclog.h"
+
+#include <algorithm>
+#include <random>
+#include <sys/socket.h>
+
+namespace hvnetpp {
+
+namespace {
+
+const uint32_t kDefaultLifetime = 600;
+const uint32_t kMaxLifetime = 3600;
+const uint32_t kPermissionLifetime = 300;
+const uint32_t kChannelLifetime = 600;
+// Allocations are revisited at least this often to sweep stale
+// permissions and channels.
+const uint32_t kSweepInterval = 60;
+// The previous nonce stays valid for one more interval.
+const double kNonceRotationSeconds = 300.0;
+const size_t kWheelSlots = 128;
+const uint8_t kUdpTransport = 17;
+const uint16_t kMinChannel = 0x4000;
+const uint16_t kMaxChannel = 0x4FFF;
+const size_t kChannelDataHeaderSize = 4;
+// Largest reply other than a Data indication.
+const size_t kReplySize = 512;
+
+std::string makeNonce() {
+    std::random_device rd;
+    static const char kHex[] = "0123456789abcdef";
+    std::string nonce;
+    for (int i = 0; i < 16; ++i) {
+        nonce += kHex[rd() & 0xf];
+    }
+    return nonce;
+}
+
+// LIFETIME clamped to [default, max] (RFC 8656 7.2); only a Refresh may
+// ask for 0, which deletes the allocation.
+uint32_t requestedLifetime(const StunMessage& request, bool allowZero) {
+    const char* value;
+    size_t len;
+    if (!request.findAttribute(stun::kAttrLifetime, &value, &len) || len != 4) {
+        return kDefaultLifetime;
+    }
+    const uint32_t lifetime = rtp::readBe32(reinterpret_cast<const uint8_t*>(value));
+    if (lifetime == 0 && allowZero) {
+        return 0;
+    }
+    return std::max(kDefaultLifetime, std::min(lifetime, kMaxLifetime));
+}
+
+} // namespace
+
+TurnServer::AddrKey::AddrKey(const InetAddress& addr, bool withPort)
+    : family(addr.family()), port(withPort ? addr.toPort() : 0) {
+    memset(ip, 0, sizeof ip);
+    if (addr.family() == AF_INET6) {
+        const struct sockaddr_in6* sin6 = reinterpret_cast<const struct sockaddr_in6*>(addr.getSockAddr());
+        memcpy(ip, &sin6->sin6_addr, 16);
+    } else {
+        const struct sockaddr_in* sin = reinterpret_cast<const struct sockaddr_in*>(addr.getSockAddr());
+        memcpy(ip, &sin->sin_addr, 4);
+    }
+}
+
+size_t TurnServer::AddrKeyHash::operator()(const AddrKey& key) const {
+    uint64_t h = 14695981039346656037ULL; // FNV-1a
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(&key);
+    for (size_t i = 0; i < sizeof key; ++i) {
+        h = (h ^ p[i]) * 1099511628211ULL;
+    }
+    return static_cast<size_t>(h);
+}
+
+TurnServer::TurnServer(EventLoop* loop, const InetAddress& listenAddr, const InetAddress& relayIp,
+                       const std::string& realm, const std::string& name)
+    : loop_(loop),
+      listenAddr_(listenAddr),
+      relayIp_(relayIp),
+      realm_(realm),
+      name_(name),
+      nonce_(makeNonce()),
+      socket_(new UdpSocket(loop, name)),
+      relayReadBuf_(std::make_shared<std::vector<char>>(UdpSocket::kReadBufferSize)),
+      wheel_(new TimingWheel(loop, kWheelSlots, 1.0, [this](uint64_t id) { onExpire(id); })),
+      nextId_(1),
+      maxAllocations_(10000),
+      scratch_(65536 + 64),
+      indicationSeq_(0),
+      stats_{0, 0, 0, 0, 0, 0} {
+    nonceTimer_ = loop_->runEvery(kNonceRotationSeconds, [this]() { rotateNonce(); });
+}
+
+TurnServer::~TurnServer() {
+    loop_->assertInLoopThread();
+    loop_->cancel(nonceTimer_);
+}
+
+void TurnServer::addUser(const std::string& username, const std::string& password) {
+    stun::prepareLongTermKey(username, realm_, password, &users_[username]);
+}
+
+void TurnServer::removeUser(const std::string& username) {
+    users_.erase(username);
+}
+
+void TurnServer::start() {
+    loop_->assertInLoopThread();
+    socket_->setPacketCallback([this](const InetAddress& client, const char* data, size_t len) {
+        onClientPacket(client, data, len);
+    });
+    socket_->bind(listenAddr_);
+}
+
+void TurnServer::rotateNonce() {
+    previousNonce_.swap(nonce_);
+    nonce_ = makeNonce();
+}
+
+bool TurnServer::nonceValid(const char* nonce, size_t len) const {
+    return (len == nonce_.size() && memcmp(nonce, nonce_.data(), len) == 0)
+        || (!previousNonce_.empty() && len == previousNonce_.size()
+            && memcmp(nonce, previousNonce_.data(), len) == 0);
+}
+
+void TurnServer::onClientPacket(const InetAddress& client, const char* data, size_t len) {
+    const uint8_t first = len > 0 ? static_cast<uint8_t>(data[0]) : 0;
+    if (first >= 0x40 && first <= 0x4F) {
+        onChannelData(client, data, len);
+        return;
+    }
+    StunMessage message;
+    if (stun::classify(data, len) != stun::kStunPacket || !message.parse(data, len)) {
+        ++stats_.dropped;
+        return;
+    }
+    if (message.messageClass() == stun::kClassRequest) {
+        onRequest(client, message);
+    } else if (message.type() == (stun::kMethodSend | stun::kClassIndication)) {
+        onSendIndication(client, message);
+    } else {
+        ++stats_.dropped;
+    }
+}
+
+void TurnServer::onChannelData(const InetAddress& client, const char* data, size_t len) {
+    std::unique_ptr<Allocation>* found = allocations_.find(AddrKey(client, true));
+    if (!found || len < kChannelDataHeaderSize) {
+        ++stats_.dropped;
+        return;
+    }
+    Allocation* alloc = found->get();
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(data);
+    const uint16_t number = rtp::readBe16(p);
+    const size_t length = rtp::readBe16(p + 2);
+    Channel* channel = alloc->channels.find(number);
+    if (kChannelDataHeaderSize + length > len || !channel || channel->expiry <= wheel_->now()
+        || !permitted(alloc, channel->peer)) {
+        ++stats_.dropped;
+        return;
+    }
+    if (alloc->relay->sendTo(data + kChannelDataHeaderSize, length, channel->peer) >= 0) {
+        ++stats_.toPeerPackets;
+        stats_.toPeerBytes += length;
+    }
+}
+
+void TurnServer::onSendIndication(const InetAddress& client, const StunMessage& indication) {
+    std::unique_ptr<Allocation>* found = allocations_.find(AddrKey(client, true));
+    const char* peerValue;
+    size_t peerLen;
+    const char* payload;
+    size_t payloadLen;
+    InetAddress peer;
+    if (!found
+        || !indication.findAttribute(stun::kAttrXorPeerAddress, &peerValue, &peerLen)
+        || !indication.findAttribute(stun::kAttrData, &payload, &payloadLen)
+        || !stun::readXorAddress(peerValue, peerLen, indication.transactionId(), &peer)
+        || !permitted(found->get(), peer)) {
+        ++stats_.dropped;
+        return;
+    }
+    if ((*found)->relay->sendTo(payload, payloadLen, peer) >= 0) {
+        ++stats_.toPeerPackets;
+        stats_.toPeerBytes += payloadLen;
+    }
+}
+
+void TurnServer::onRelayPacket(Allocation* alloc, const InetAddress& peer, const char* data, size_t len) {
+    if (!permitted(alloc, peer)) {
+        ++stats_.dropped;
+        return;
+    }
+    uint16_t* number = alloc->channelByPeer.find(AddrKey(peer, true));
+    Channel* channel = number ? alloc->channels.find(*number) : nullptr;
+    ssize_t n;
+    if (channel && channel->expiry > wheel_->now() && len <= 0xffff) {
+        // ChannelData header in front of the datagram, without copying it.
+        uint8_t header[kChannelDataHeaderSize];
+        rtp::writeBe16(header, *number);
+        rtp::writeBe16(header + 2, static_cast<uint16_t>(len));
+        struct iovec iov[2];
+        iov[0].iov_base = header;
+        iov[0].iov_len = sizeof header;
+        iov[1].iov_base = const_cast<char*>(data);
+        iov[1].iov_len = len;
+        struct msghdr msg;
+        memset(&msg, 0, sizeof msg);
+        msg.msg_name = const_cast<struct sockaddr*>(alloc->client.getSockAddr());
+        msg.msg_namelen = alloc->client.getSockAddrLen();
+        msg.msg_iov = iov;
+        msg.msg_iovlen = 2;
+        n = ::sendmsg(socket_->fd(), &msg, 0);
+    } else {
+        char transactionId[stun::kTransactionIdSize];
+        memset(transactionId, 0, sizeof transactionId);
+        const uint32_t seq = ++indicationSeq_;
+        memcpy(transactionId, &seq, sizeof seq);
+        StunWriter writer(scratch_.data(), scratch_.size(), stun::kMethodData | stun::kClassIndication,
+                          transactionId);
+        writer.addXorAddress(stun::kAttrXorPeerAddress, peer);
+        writer.addAttribute(stun::kAttrData, data, len);
+        n = writer.size() > 0 ? socket_->sendTo(scratch_.data(), writer.size(), alloc->client) : -1;
+    }
+    if (n >= 0) {
+        ++stats_.toClientPackets;
+        stats_.toClientBytes += len;
+    }
+}
+
+void TurnServer::onRequest(const InetAddress& client, const StunMessage& request) {
+    if (request.method() == stun::kMethodBinding) {
+        char buf[kReplySize];
+        StunWriter writer(buf, sizeof buf, stun::kBindingSuccess, request.transactionId());
+        writer.addXorMappedAddress(client);
+        reply(client, writer, nullptr);
+        return;
+    }
+
+    // Long-term credentials: challenge first, then check nonce, user and MAC.
+    if (!request.hasUsername() || !request.hasIntegrity()) {
+        sendChallenge(client, request, 401, "Unauthorized");
+        return;
+    }
+    const char* nonce;
+    size_t nonceLen;
+    if (!request.findAttribute(stun::kAttrNonce, &nonce, &nonceLen) || !nonceValid(nonce, nonceLen)) {
+        sendChallenge(client, request, 438, "Stale Nonce");
+        return;
+    }
+    auto user = users_.find(std::string(request.username(), request.usernameSize()));
+    if (user == users_.end() || !request.verifyIntegrity(user->second)) {
+        sendChallenge(client, request, 401, "Unauthorized");
+        return;
+    }
+    const std::string& username = user->first;
+    const stun::IntegrityKey& key = user->second;
+
+    if (request.method() == stun::kMethodAllocate) {
+        handleAllocate(client, request, username, key);
+        return;
+    }
+    std::unique_ptr<Allocation>* found = allocations_.find(AddrKey(client, true));
+    if (!found) {
+        sendError(client, request, 437, "Allocation Mismatch", &key);
+        return;
+    }
+    // Only the user who allocated may manage the allocation.
+    if ((*found)->username != username) {
+        sendError(client, request, 441, "Wrong Credentials", &key);
+        return;
+    }
+    switch (request.method()) {
+    case stun::kMethodRefresh:
+        handleRefresh(found->get(), request);
+        break;
+    case stun::kMethodCreatePermission:
+        handleCreatePermission(found->get(), request);
+        break;
+    case stun::kMethodChannelBind:
+        handleChannelBind(found->get(), request);
+        break;
+    default:
+        sendError(client, request, 400, "Bad Request", &key);
+        break;
+    }
+}
+
+void TurnServer::handleAllocate(const InetAddress& client, const StunMessage& request,
+                                const std::string& username, const stun::IntegrityKey& key) {
+    const AddrKey clientKey(client, true);
+    std::unique_ptr<Allocation>* existing = allocations_.find(clientKey);
+    if (existing) {
+        // A retransmitted Allocate gets the same answer, any other a 437.
+        if (memcmp((*existing)->transactionId, request.transactionId(), stun::kTransactionIdSize) == 0) {
+            sendAllocateSuccess(client, request, **existing);
+        } else {
+            sendError(client, request, 437, "Allocation Mismatch", &key);
+        }
+        return;
+    }
+    const char* transport;
+    size_t transportLen;
+    if (!request.findAttribute(stun::kAttrRequestedTransport, &transport, &transportLen) || transportLen != 4) {
+        sendError(client, request, 400, "Bad Request", &key);
+        return;
+    }
+    if (static_cast<uint8_t>(transport[0]) != kUdpTransport) {
+        sendError(client, request, 442, "Unsupported Transport Protocol", &key);
+        return;
+    }
+    if (allocations_.size() >= maxAllocations_) {
+        sendError(client, request, 486, "Allocation Quota Reached", &key);
+        return;
+    }
+
+    std::unique_ptr<Allocation> alloc(new Allocation);
+    alloc->id = nextId_++;
+    alloc->client = client;
+    alloc->clientKey = clientKey;
+    alloc->username = username;
+    alloc->key = key;
+    memcpy(alloc->transactionId, request.transactionId(), stun::kTransactionIdSize);
+    const uint32_t lifetime = requestedLifetime(request, false);
+    alloc->expiry = wheel_->now() + lifetime;
+
+    alloc->relay.reset(new UdpSocket(loop_, name_ + "#relay" + std::to_string(alloc->id)));
+    alloc->relay->setReadBuffer(relayReadBuf_);
+    Allocation* raw = alloc.get();
+    alloc->relay->setPacketCallback([this, raw](const InetAddress& peer, const char* data, size_t len) {
+        onRelayPacket(raw, peer, data, len);
+    });
+    InetAddress relayAddr(relayIp_);
+    if (relayAddr.family() == AF_INET6) {
+        struct sockaddr_in6 sin6 = *reinterpret_cast<const struct sockaddr_in6*>(relayAddr.getSockAddr());
+        sin6.sin6_port = 0;
+        relayAddr = InetAddress(sin6);
+    } else {
+        struct sockaddr_in sin = *reinterpret_cast<const struct sockaddr_in*>(relayAddr.getSockAddr());
+        sin.sin_port = 0;
+        relayAddr = InetAddress(sin);
+    }
+    if (!alloc->relay->tryBind(relayAddr)) {
+        // Out of ports or a bad relay address; alloc is discarded unregistered.
+        sendError(client, request, 508, "Insufficient Capacity", &key);
+        return;
+    }
+    alloc->relayAddr = InetAddress(sockets::getLocalAddr(alloc->relay->fd()));
+
+    wheel_->schedule(alloc->id, std::min(lifetime, kSweepInterval));
+    allocationsById_.insert(alloc->id, raw);
+    allocations_.insert(clientKey, std::move(alloc));
+    stats_.allocations = allocations_.size();
+    RTCLOG(RTC_DEBUG, "TurnServer %s allocated %s for %s", name_.c_str(),
+           raw->relayAddr.toIpPort().c_str(), client.toIpPort().c_str());
+    sendAllocateSuccess(client, request, *raw);
+}
+
+void TurnServer::sendAllocateSuccess(const InetAddress& client, const StunMessage& request,
+                                     const Allocation& alloc) {
+    char buf[kReplySize];
+    StunWriter writer(buf, sizeof buf, stun::kMethodAllocate | stun::kClassSuccess, request.transactionId());
+    writer.addXorAddress(stun::kAttrXorRelayedAddress, alloc.relayAddr);
+    writer.addUint32(stun::kAttrLifetime, alloc.expiry - wheel_->now());
+    writer.addXorMappedAddress(client);
+    reply(client, writer, &alloc.key);
+}
+
+void TurnServer::handleRefresh(Allocation* alloc, const StunMessage& request) {
+    const uint32_t lifetime = requestedLifetime(request, true);
+    const InetAddress client = alloc->client;
+    const stun::IntegrityKey key = alloc->key;
+    if (lifetime == 0) {
+        destroyAllocation(alloc);
+    } else {
+        alloc->expiry = wheel_->now() + lifetime;
+    }
+    char buf[kReplySize];
+    StunWriter writer(buf, sizeof buf, stun::kMethodRefresh | stun::kClassSuccess, request.transactionId());
+    writer.addUint32(stun::kAttrLifetime, lifetime);
+    reply(client, writer, &key);
+}
+
+void TurnServer::handleCreatePermission(Allocation* alloc, const StunMessage& request) {
+    size_t cursor = 0;
+    uint16_t type;
+    const char* value;
+    size_t len;
+    int count = 0;
+    // Validate every peer before installing any.
+    while (request.nextAttribute(&cursor, &type, &value, &len)) {
+        InetAddress peer;
+        if (type != stun::kAttrXorPeerAddress) {
+            continue;
+        }
+        if (!stun::readXorAddress(value, len, request.transactionId(), &peer)) {
+            sendError(alloc->client, request, 400, "Bad Request", &alloc->key);
+            return;
+        }
+        if (peer.family() != alloc->relayAddr.family()) {
+            sendError(alloc->client, request, 443, "Peer Address Family Mismatch", &alloc->key);
+            return;
+        }
+        ++count;
+    }
+    if (count == 0) {
+        sendError(alloc->client, request, 400, "Bad Request", &alloc->key);
+        return;
+    }
+    cursor = 0;
+    while (request.nextAttribute(&cursor, &type, &value, &len)) {
+        InetAddress peer;
+        if (type == stun::kAttrXorPeerAddress && stun::readXorAddress(value, len, request.transactionId(), &peer)) {
+            addPermission(alloc, peer);
+        }
+    }
+    char buf[kReplySize];
+    StunWriter writer(buf, sizeof buf, stun::kMethodCreatePermission | stun::kClassSuccess,
+                      request.transactionId());
+    reply(alloc->client, writer, &alloc->key);
+}
+
+void TurnServer::handleChannelBind(Allocation* alloc, const StunMessage& request) {
+    const char* value;
+    size_t len;
+    const char* peerValue;
+    size_t peerLen;
+    InetAddress peer;
+    if (!request.findAttribute(stun::kAttrChannelNumber, &value, &len) || len != 4
+        || !request.findAttribute(stun::kAttrXorPeerAddress, &peerValue, &peerLen)
+        || !stun::readXorAddress(peerValue, peerLen, request.transactionId(), &peer)) {
+        sendError(alloc->client, request, 400, "Bad Request", &alloc->key);
+        return;
+    }
+    if (peer.family() != alloc->relayAddr.family()) {
+        sendError(alloc->client, request, 443, "Peer Address Family Mismatch", &alloc->key);
+        return;
+    }
+    const uint16_t number = rtp::readBe16(reinterpret_cast<const uint8_t*>(value));
+    const AddrKey peerKey(peer, true);
+    Channel* bound = alloc->channels.find(number);
+    uint16_t* boundNumber = alloc->channelByPeer.find(peerKey);
+    // A channel sticks to its peer and a peer to its channel.
+    if (number < kMinChannel || number > kMaxChannel
+        || (bound && !(AddrKey(bound->peer, true) == peerKey))
+        || (boundNumber && *boundNumber != number)) {
+        sendError(alloc->client, request, 400, "Bad Request", &alloc->key);
+        return;
+    }
+    Channel channel;
+    channel.peer = peer;
+    channel.expiry = wheel_->now() + kChannelLifetime;
+    alloc->channels.insert(number, channel);
+    alloc->channelByPeer.insert(peerKey, number);
+    addPermission(alloc, peer);
+
+    char buf[kReplySize];
+    StunWriter writer(buf, sizeof buf, stun::kMethodChannelBind | stun::kClassSuccess, request.transactionId());
+    reply(alloc->client, writer, &alloc->key);
+}
+
+void TurnServer::reply(const InetAddress& client, StunWriter& writer, const stun::IntegrityKey* key) {
+    if (key) {
+        writer.addMessageIntegrity(*key);
+    }
+    writer.addFingerprint();
+    if (writer.size() == 0) {
+        RTCLOG(RTC_ERROR, "TurnServer %s reply to %s too large", name_.c_str(), client.toIpPort().c_str());
+        return;
+    }
+    socket_->sendTo(writer.data(), writer.size(), client);
+}
+
+void TurnServer::sendError(const InetAddress& client, const StunMessage& request, int code,
+                           const char* reason, const stun::IntegrityKey* key) {
+    char buf[kReplySize];
+    StunWriter writer(buf, sizeof buf, request.method() | stun::kClassError, request.transactionId());
+    writer.addErrorCode(code, reason);
+    reply(client, writer, key);
+}
+
+void TurnServer::sendChallenge(const InetAddress& client, const StunMessage& request, int code,
+                               const char* reason) {
+    char buf[kReplySize];
+    StunWriter writer(buf, sizeof buf, request.method() | stun::kClassError, request.transactionId());
+    writer.addErrorCode(code, reason);
+    writer.addAttribute(stun::kAttrRealm, realm_.data(), realm_.size());
+    writer.addAttribute(stun::kAttrNonce, nonce_.data(), nonce_.size());
+    reply(client, writer, nullptr);
+}
+
+bool TurnServer::permitted(Allocation* alloc, const InetAddress& peer) {
+    const uint32_t* expiry = alloc->permissions.find(AddrKey(peer, false));
+    return expiry && *expiry > wheel_->now();
+}
+
+void TurnServer::addPermission(Allocation* alloc, const InetAddress& peer) {
+    alloc->permissions.insert(AddrKey(peer, false), wheel_->now() + kPermissionLifetime);
+}
+
+void TurnServer::onExpire(uint64_t id) {
+    Allocation** found = allocationsById_.find(id);
+    if (!found) {
+        return;
+    }
+    Allocation* alloc = *found;
+    const uint32_t now = wheel_->now();
+    if (alloc->expiry <= now) {
+        RTCLOG(RTC_DEBUG, "TurnServer %s allocation %s expired", name_.c_str(), alloc->relayAddr.toIpPort().c_str());
+        destroyAllocation(alloc);
+        return;
+    }
+    alloc->permissions.eraseIf([now](const AddrKey&, uint32_t expiry) { return expiry <= now; });
+    alloc->channels.eraseIf([alloc, now](uint16_t, const Channel& channel) {
+        if (channel.expiry > now) {
+            return false;
+        }
+        alloc->channelByPeer.erase(AddrKey(channel.peer, true));
+        return true;
+    });
+    wheel_->schedule(id, std::min(alloc->expiry - now, kSweepInterval));
+}
+
+void TurnServer::destroyAllocation(Allocation* alloc) {
+    allocationsById_.erase(alloc->id);
+    allocations_.erase(alloc->clientKey); // deletes alloc and its relay socket
+    stats_.allocations = allocations_.size();
+}
+
+} // namespace hvnetpp
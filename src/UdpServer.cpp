@@ -0,0 +1,130 @@
+#include "hvnetpp/UdpServer.h"
+#include "hvnetpp/EventLoop.h"
+#include "hvnetpp/EventLoopThreadPool.h"
+#include "hvnetpp/UdpSocket.h"
+#include "rtclog.h"
+
+#include <cerrno>
+#include <cstring>
+#include <future>
+#include <linux/filter.h>
+#include <sys/socket.h>
+
+#ifndef SO_ATTACH_REUSEPORT_CBPF
+#define SO_ATTACH_REUSEPORT_CBPF 51
+#endif
+
+namespace hvnetpp {
+
+UdpServer::UdpServer(EventLoop* loop, const InetAddress& listenAddr, const std::string& name)
+    : loop_(loop),
+      listenAddr_(listenAddr),
+      name_(name),
+      threadPool_(new EventLoopThreadPool(loop, name)),
+      steering_(false),
+      started_(false) {
+}
+
+UdpServer::~UdpServer() {
+    loop_->assertInLoopThread();
+    // Each socket must go away on its own loop, before that loop's thread.
+    for (size_t i = 0; i < sockets_.size(); ++i) {
+        EventLoop* loop = loops_[i];
+        UdpSocket* socket = sockets_[i].release();
+        if (loop->isInLoopThread()) {
+            delete socket;
+        } else {
+            std::promise<void> done;
+            loop->runInLoop([socket, &done]() {
+                delete socket;
+                done.set_value();
+            });
+            done.get_future().wait();
+        }
+    }
+}
+
+void UdpServer::setThreadNum(int numThreads) {
+    threadPool_->setThreadNum(numThreads);
+}
+
+void UdpServer::start() {
+    loop_->assertInLoopThread();
+    if (started_) {
+        return;
+    }
+    started_ = true;
+    threadPool_->start();
+    loops_ = threadPool_->getAllLoops();
+    sockets_.resize(loops_.size());
+
+    // Bind one socket after the other so the group order matches loops_.
+    for (size_t i = 0; i < loops_.size(); ++i) {
+        if (loops_[i]->isInLoopThread()) {
+            openSocket(loops_[i], i);
+        } else {
+            std::promise<void> done;
+            loops_[i]->runInLoop([this, i, &done]() {
+                openSocket(loops_[i], i);
+                done.set_value();
+            });
+            done.get_future().wait();
+        }
+    }
+    if (steering_) {
+        attachSteeringProgram();
+    }
+}
+
+void UdpServer::openSocket(EventLoop* loop, size_t index) {
+    std::unique_ptr<UdpSocket> socket(new UdpSocket(loop, name_ + "#" + std::to_string(index)));
+    UdpSocket* raw = socket.get();
+    if (socketInitCallback_) {
+        socketInitCallback_(raw);
+    }
+    raw->setPacketCallback([this, raw](const InetAddress& peer, const char* data, size_t len) {
+        if (packetCallback_) {
+            packetCallback_(raw, peer, data, len);
+        }
+    });
+    raw->bind(listenAddr_);
+    sockets_[index] = std::move(socket);
+}
+
+// Picks a socket from the peer's address and port, the only part of the
+// 4-tuple that varies on one server port, modulo the group size. The
+// program is shared by the whole reuseport group. Assumes IPv4 headers
+// without options and IPv6 headers without extension headers.
+// Jump offsets count instructions from the one after the jump: the
+// version test at [2] goes to [3] for IPv4 and [2+1+4] = [7] for IPv6,
+// and the IPv4 branch's JA at [6] goes to [6+1+3] = [10]. Keep the index
+// comments in step when editing.
+void UdpServer::attachSteeringProgram() {
+    const uint32_t kNet = static_cast<uint32_t>(SKF_NET_OFF);
+    struct sock_filter code[] = {
+        { BPF_LD | BPF_B | BPF_ABS, 0, 0, kNet },                 // [0] IP version
+        { BPF_ALU | BPF_RSH | BPF_K, 0, 0, 4 },                    // [1]
+        { BPF_JMP | BPF_JEQ | BPF_K, 4, 0, 4 },                    // [2] v4 -> [3], else [7]
+        { BPF_LD | BPF_W | BPF_ABS, 0, 0, kNet + 12 },            // [3] IPv4 source
+        { BPF_MISC | BPF_TAX, 0, 0, 0 },                           // [4]
+        { BPF_LD | BPF_H | BPF_ABS, 0, 0, kNet + 20 },            // [5] UDP source port
+        { BPF_JMP | BPF_JA, 0, 0, 3 },                             // [6] -> [10]
+        { BPF_LD | BPF_W | BPF_ABS, 0, 0, kNet + 20 },            // [7] IPv6 source, low word
+        { BPF_MISC | BPF_TAX, 0, 0, 0 },                           // [8]
+        { BPF_LD | BPF_H | BPF_ABS, 0, 0, kNet + 40 },            // [9] UDP source port
+        { BPF_ALU | BPF_XOR | BPF_X, 0, 0, 0 },                    // [10]
+        { BPF_ALU | BPF_MUL | BPF_K, 0, 0, 2654435761u },          // spread the bits
+        { BPF_ALU | BPF_RSH | BPF_K, 0, 0, 16 },
+        { BPF_ALU | BPF_MOD | BPF_K, 0, 0, static_cast<uint32_t>(sockets_.size()) },
+        { BPF_RET | BPF_A, 0, 0, 0 },
+    };
+    struct sock_fprog prog;
+    prog.len = sizeof code / sizeof code[0];
+    prog.filter = code;
+    if (::setsockopt(sockets_[0]->fd(), SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof prog) != 0) {
+        RTCLOG(RTC_WARN, "UdpServer::attachSteeringProgram [%s] failed: %s, using the kernel hash",
+               name_.c_str(), strerror(errno));
+    }
+}
+
+} // namespace hvnetpp
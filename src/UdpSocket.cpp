@@ -3,33 +3,74 @@
 #include "hvnetpp/Channel.h"
 #include "hvnetpp/Buffer.h"
 #include "hvnetpp/SocketsOps.h"
+#include "hvnetpp/StunResponder.h"
 #include "rtclog.h"
 
 #include <errno.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
 #include <sys/socket.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <algorithm>
 #include <cstring>
+#include <assert.h>
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
 
 namespace hvnetpp {
 
 namespace {
 
-socklen_t socketAddrLength(const InetAddress& addr) {
-    return static_cast<socklen_t>(
-        addr.family() == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in));
+// Room for a UDP_GRO segment size and an SCM_TIMESTAMPING triple.
+const size_t kControlSpace = CMSG_SPACE(sizeof(int)) + CMSG_SPACE(3 * sizeof(struct timespec));
+const size_t kMaxGsoSegments = 64;
+
+// Segment size of a GRO-coalesced datagram, 0 if it was not coalesced.
+size_t groSegmentSize(const struct msghdr& msg) {
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+         cmsg = CMSG_NXTHDR(const_cast<struct msghdr*>(&msg), cmsg)) {
+        if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+            int size = 0;
+            memcpy(&size, CMSG_DATA(cmsg), sizeof size);
+            return size > 0 ? static_cast<size_t>(size) : 0;
+        }
+    }
+    return 0;
 }
 
+// Datagrams per sendmmsg() call.
+const size_t kMaxSendBatch = 64;
+
 } // namespace
 
+const size_t UdpSocket::kReadBufferSize;
+
 UdpSocket::UdpSocket(EventLoop* loop, const std::string& name)
     : loop_(loop),
       name_(name),
       family_(AF_UNSPEC),
       sockfd_(-1),
       channel_(),
-      callbackToken_(std::make_shared<bool>(true)),
-      readBuf_(65536) { // Max UDP packet size
+      stunResponder_(nullptr),
+      connected_(false),
+      batchSize_(0),
+      maxPacketSize_(0),
+      readBudget_(0),
+      groEnabled_(false),
+      gsoSupported_(true),
+      timestamping_(false),
+      receiveTimestampNs_(0),
+      sendQueueHead_(0),
+      sendQueueSize_(0),
+      dropPolicy_(kDropNewest),
+      flushPending_(false),
+      sendStats_() {
 }
 
 UdpSocket::~UdpSocket() {
@@ -60,15 +101,32 @@ bool UdpSocket::ensureSocket(sa_family_t family) {
 
     sockets::setReuseAddr(sockfd_, true);
     sockets::setReusePort(sockfd_, true);
-    std::weak_ptr<bool> token = callbackToken_;
-    channel_->setReadCallback([this, token]() {
-        if (token.lock()) {
-            handleRead();
-        }
-    });
+    channel_->tie(liveness_);
+    channel_->setReadCallback([this]() { handleRead(); });
+    channel_->setWriteCallback([this]() { handleWrite(); });
     return true;
 }
 
+void UdpSocket::enableBatchRead(size_t batchSize, size_t maxPacketSize, size_t budget) {
+    batchSize_ = batchSize > 0 ? batchSize : 1;
+    maxPacketSize_ = maxPacketSize;
+    readBudget_ = budget > batchSize_ ? budget : batchSize_;
+    batchBuf_.assign(batchSize_ * maxPacketSize_, 0);
+    batchMsgs_.assign(batchSize_, mmsghdr());
+    batchIovecs_.resize(batchSize_);
+    batchAddrs_.resize(batchSize_);
+    batchPackets_.resize(batchSize_, UdpPacket{ nullptr, 0, InetAddress(), 0 });
+    batchControl_.assign(batchSize_ * kControlSpace, 0);
+    for (size_t i = 0; i < batchSize_; ++i) {
+        batchIovecs_[i].iov_base = &batchBuf_[i * maxPacketSize_];
+        batchIovecs_[i].iov_len = maxPacketSize_;
+        struct msghdr& hdr = batchMsgs_[i].msg_hdr;
+        hdr.msg_iov = &batchIovecs_[i];
+        hdr.msg_iovlen = 1;
+        hdr.msg_name = &batchAddrs_[i];
+    }
+}
+
 bool UdpSocket::bind(const InetAddress& addr) {
     if (!ensureSocket(addr.family())) {
         return false;
@@ -78,43 +136,426 @@ bool UdpSocket::bind(const InetAddress& addr) {
     return true;
 }
 
+bool UdpSocket::tryBind(const InetAddress& addr) {
+    if (!ensureSocket(addr.family())) {
+        return false;
+    }
+    if (sockets::bind(sockfd_, addr.getSockAddr()) < 0) {
+        const int savedErrno = errno;
+        RTCLOG(RTC_ERROR, "UdpSocket::tryBind() %s to %s: %s", name_.c_str(),
+               addr.toIpPort().c_str(), strerror(savedErrno));
+        // The channel was never added to the poller.
+        channel_.reset();
+        sockets::close(sockfd_);
+        sockfd_ = -1;
+        family_ = AF_UNSPEC;
+        errno = savedErrno;
+        return false;
+    }
+    channel_->enableReading();
+    return true;
+}
+
 ssize_t UdpSocket::sendTo(const void* data, size_t len, const InetAddress& destAddr) {
     if (!ensureSocket(destAddr.family())) {
         return -1;
     }
-    return ::sendto(sockfd_, data, len, 0, destAddr.getSockAddr(), socketAddrLength(destAddr));
+    if (isPeer(destAddr)) {
+        return send(data, len);
+    }
+    // The queue belongs to the loop thread; other threads send directly.
+    if (!sendQueue_.empty() && loop_->isInLoopThread()) {
+        return queueSendTo(data, len, &destAddr);
+    }
+    return ::sendto(sockfd_, data, len, 0, destAddr.getSockAddr(), sockets::sockaddrLength(destAddr.getSockAddr()));
+}
+
+std::unique_ptr<UdpSocket> UdpSocket::connectPeer(const InetAddress& peer) {
+    loop_->assertInLoopThread();
+    if (sockfd_ < 0 || peer.family() != family_) {
+        RTCLOG(RTC_ERROR, "UdpSocket::connectPeer() %s is not bound for %s", name_.c_str(), peer.toIpPort().c_str());
+        errno = EINVAL;
+        return nullptr;
+    }
+    InetAddress local(sockets::getLocalAddr(sockfd_));
+    std::unique_ptr<UdpSocket> child(new UdpSocket(loop_, name_ + "->" + peer.toIpPort()));
+    child->ensureSocket(family_);
+    if (::bind(child->sockfd_, local.getSockAddr(), sockets::sockaddrLength(local.getSockAddr())) != 0
+        || ::connect(child->sockfd_, peer.getSockAddr(), sockets::sockaddrLength(peer.getSockAddr())) != 0) {
+        RTCLOG(RTC_ERROR, "UdpSocket::connectPeer() %s to %s: %s", name_.c_str(),
+               peer.toIpPort().c_str(), strerror(errno));
+        return nullptr;
+    }
+    child->connected_ = true;
+    child->peerAddr_ = peer;
+
+    // Between bind() and connect() the child was an unconnected member of
+    // the reuseport group and may hold datagrams of other peers.
+    receiveTimestampNs_ = 0;
+    std::vector<char>& buf = readBuffer();
+    while (true) {
+        struct sockaddr_storage from;
+        socklen_t fromLen = sizeof from;
+        ssize_t n = ::recvfrom(child->sockfd_, buf.data(), buf.size(), MSG_DONTWAIT,
+                               reinterpret_cast<struct sockaddr*>(&from), &fromLen);
+        if (n < 0) {
+            break;
+        }
+        if (packetCallback_ || readCallback_ || stunResponder_) {
+            deliver(buf.data(), n, 0, InetAddress(from));
+        }
+    }
+    child->channel_->enableReading();
+    return child;
+}
+
+ssize_t UdpSocket::send(const void* data, size_t len) {
+    if (!connected_) {
+        errno = ENOTCONN;
+        return -1;
+    }
+    if (!sendQueue_.empty() && loop_->isInLoopThread()) {
+        return queueSendTo(data, len, nullptr);
+    }
+    return ::send(sockfd_, data, len, 0);
+}
+
+// Sends to the connected peer must not name it, or the kernel routes each
+// one again instead of using the socket's cached route.
+bool UdpSocket::isPeer(const InetAddress& addr) const {
+    if (!connected_) {
+        return false;
+    }
+    const socklen_t len = sockets::sockaddrLength(addr.getSockAddr());
+    return len == sockets::sockaddrLength(peerAddr_.getSockAddr()) && memcmp(addr.getSockAddr(), peerAddr_.getSockAddr(), len) == 0;
 }
 
 ssize_t UdpSocket::sendTo(Buffer* buf, const InetAddress& destAddr) {
     return sendTo(buf->peek(), buf->readableBytes(), destAddr);
 }
 
+ssize_t UdpSocket::sendSegmentsTo(const void* data, size_t len, size_t segmentSize, const InetAddress& destAddr) {
+    if (!ensureSocket(destAddr.family())) {
+        return -1;
+    }
+    if (segmentSize == 0 || len > 65535 || (len + segmentSize - 1) / segmentSize > kMaxGsoSegments) {
+        errno = EINVAL;
+        return -1;
+    }
+    const bool toPeer = isPeer(destAddr);
+    if (gsoSupported_ && len > segmentSize) {
+        struct iovec iov;
+        iov.iov_base = const_cast<void*>(data);
+        iov.iov_len = len;
+        char control[CMSG_SPACE(sizeof(uint16_t))];
+        memset(control, 0, sizeof control);
+        struct msghdr msg;
+        memset(&msg, 0, sizeof msg);
+        if (!toPeer) {
+            msg.msg_name = const_cast<struct sockaddr*>(destAddr.getSockAddr());
+            msg.msg_namelen = sockets::sockaddrLength(destAddr.getSockAddr());
+        }
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof control;
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_UDP;
+        cmsg->cmsg_type = UDP_SEGMENT;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+        const uint16_t gsoSize = static_cast<uint16_t>(segmentSize);
+        memcpy(CMSG_DATA(cmsg), &gsoSize, sizeof gsoSize);
+
+        ssize_t n = ::sendmsg(sockfd_, &msg, 0);
+        // EIO: the device can't checksum the segments.
+        if (n >= 0 || (errno != EIO && errno != EINVAL && errno != ENOPROTOOPT && errno != EOPNOTSUPP)) {
+            return n;
+        }
+        RTCLOG(RTC_WARN, "UdpSocket::sendSegmentsTo() %s GSO unavailable (%s), sending segments one by one",
+               name_.c_str(), strerror(errno));
+        gsoSupported_ = false;
+    }
+    const char* bytes = static_cast<const char*>(data);
+    size_t sent = 0;
+    while (sent < len) {
+        const size_t chunk = std::min(segmentSize, len - sent);
+        ssize_t n = toPeer
+            ? ::send(sockfd_, bytes + sent, chunk, 0)
+            : ::sendto(sockfd_, bytes + sent, chunk, 0, destAddr.getSockAddr(), sockets::sockaddrLength(destAddr.getSockAddr()));
+        if (n < 0) {
+            return sent > 0 ? static_cast<ssize_t>(sent) : -1;
+        }
+        sent += chunk;
+    }
+    return static_cast<ssize_t>(sent);
+}
+
+bool UdpSocket::enableTimestamping() {
+    if (sockfd_ < 0) {
+        errno = EBADF;
+        return false;
+    }
+    timestamping_ = sockets::enableRxTimestamps(sockfd_);
+    return timestamping_;
+}
+
+bool UdpSocket::enableGro() {
+    if (sockfd_ < 0) {
+        errno = EBADF;
+        return false;
+    }
+    int on = 1;
+    if (::setsockopt(sockfd_, SOL_UDP, UDP_GRO, &on, sizeof on) != 0) {
+        RTCLOG(RTC_WARN, "UdpSocket::enableGro() %s: %s", name_.c_str(), strerror(errno));
+        return false;
+    }
+    groEnabled_ = true;
+    return true;
+}
+
+void UdpSocket::enableSendQueue(size_t maxPackets, DropPolicy policy) {
+    loop_->assertInLoopThread();
+    assert(sendQueueSize_ == 0);
+    sendQueue_.resize(maxPackets > 0 ? maxPackets : 1);
+    sendQueueHead_ = 0;
+    dropPolicy_ = policy;
+    const size_t batch = std::min<size_t>(sendQueue_.size(), kMaxSendBatch);
+    sendMsgs_.assign(batch, mmsghdr());
+    sendIovecs_.resize(batch);
+}
+
+// A null @c destAddr queues for the connected peer.
+ssize_t UdpSocket::queueSendTo(const void* data, size_t len, const InetAddress* destAddr) {
+    loop_->assertInLoopThread();
+    if (sendQueueSize_ == sendQueue_.size()) {
+        ++sendStats_.dropped;
+        if (dropPolicy_ == kDropNewest) {
+            errno = ENOBUFS;
+            return -1;
+        }
+        sendQueueHead_ = (sendQueueHead_ + 1) % sendQueue_.size();
+        --sendQueueSize_;
+    }
+    QueuedPacket& slot = sendQueue_[(sendQueueHead_ + sendQueueSize_) % sendQueue_.size()];
+    const char* bytes = static_cast<const char*>(data);
+    slot.data.assign(bytes, bytes + len);
+    slot.toPeer = destAddr == nullptr;
+    if (destAddr) {
+        slot.dest = *destAddr;
+    }
+    ++sendQueueSize_;
+
+    // While blocked on EAGAIN handleWrite() flushes.
+    if (!flushPending_ && !channel_->isWriting()) {
+        flushPending_ = true;
+        LivenessGuard::Watcher alive = liveness_.watch();
+        loop_->queueInLoop([this, alive]() {
+            if (alive.alive()) {
+                flushPending_ = false;
+                flushSendQueue();
+            }
+        });
+    }
+    return static_cast<ssize_t>(len);
+}
+
+void UdpSocket::flushSendQueue() {
+    while (sendQueueSize_ > 0) {
+        const size_t count = std::min(sendQueueSize_, sendMsgs_.size());
+        for (size_t i = 0; i < count; ++i) {
+            QueuedPacket& packet = sendQueue_[(sendQueueHead_ + i) % sendQueue_.size()];
+            sendIovecs_[i].iov_base = packet.data.data();
+            sendIovecs_[i].iov_len = packet.data.size();
+            struct msghdr& hdr = sendMsgs_[i].msg_hdr;
+            if (packet.toPeer) {
+                hdr.msg_name = nullptr;
+                hdr.msg_namelen = 0;
+            } else {
+                hdr.msg_name = const_cast<struct sockaddr*>(packet.dest.getSockAddr());
+                hdr.msg_namelen = sockets::sockaddrLength(packet.dest.getSockAddr());
+            }
+            hdr.msg_iov = &sendIovecs_[i];
+            hdr.msg_iovlen = 1;
+        }
+        int n = ::sendmmsg(sockfd_, sendMsgs_.data(), static_cast<unsigned int>(count), 0);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                if (!channel_->isWriting()) {
+                    channel_->enableWriting();
+                }
+                return;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            // The first packet failed, skip it so the rest can go out.
+            const QueuedPacket& failed = sendQueue_[sendQueueHead_];
+            RTCLOG(RTC_WARN, "UdpSocket::flushSendQueue() %s to %s: %s", name_.c_str(),
+                   (failed.toPeer ? peerAddr_ : failed.dest).toIpPort().c_str(), strerror(errno));
+            ++sendStats_.errors;
+            n = 1;
+        } else {
+            sendStats_.sent += n;
+        }
+        sendQueueHead_ = (sendQueueHead_ + n) % sendQueue_.size();
+        sendQueueSize_ -= n;
+    }
+    if (channel_->isWriting()) {
+        channel_->disableWriting();
+    }
+}
+
+std::vector<char>& UdpSocket::readBuffer() {
+    if (!readBuf_) {
+        readBuf_ = std::make_shared<std::vector<char>>(kReadBufferSize);
+    }
+    return *readBuf_;
+}
+
+void UdpSocket::handleWrite() {
+    loop_->assertInLoopThread();
+    flushSendQueue();
+}
+
 void UdpSocket::handleRead() {
     loop_->assertInLoopThread();
+    if (batchSize_ > 0) {
+        handleBatchRead();
+        return;
+    }
     struct sockaddr_storage peerAddrStorage;
     socklen_t addrLen = sizeof peerAddrStorage;
-    ssize_t n = ::recvfrom(sockfd_, readBuf_.data(), readBuf_.size(), 0, 
-                           reinterpret_cast<struct sockaddr*>(&peerAddrStorage), &addrLen);
+    size_t segmentSize = 0;
+    ssize_t n;
+    receiveTimestampNs_ = 0;
+    std::vector<char>& buf = readBuffer();
+    if (groEnabled_ || timestamping_) {
+        struct iovec iov;
+        iov.iov_base = buf.data();
+        iov.iov_len = buf.size();
+        char control[kControlSpace];
+        struct msghdr msg;
+        memset(&msg, 0, sizeof msg);
+        msg.msg_name = &peerAddrStorage;
+        msg.msg_namelen = addrLen;
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof control;
+        n = ::recvmsg(sockfd_, &msg, 0);
+        if (n >= 0) {
+            segmentSize = groEnabled_ ? groSegmentSize(msg) : 0;
+            if (timestamping_) {
+                receiveTimestampNs_ = sockets::rxTimestampNs(msg);
+            }
+        }
+    } else {
+        n = ::recvfrom(sockfd_, buf.data(), buf.size(), 0,
+                       reinterpret_cast<struct sockaddr*>(&peerAddrStorage), &addrLen);
+    }
     
     if (n >= 0) {
-        if (readCallback_) {
-            Buffer buf;
-            buf.append(readBuf_.data(), n);
-            if (peerAddrStorage.ss_family == AF_INET6) {
-                const struct sockaddr_in6* peerAddr =
-                    reinterpret_cast<const struct sockaddr_in6*>(&peerAddrStorage);
-                InetAddress peer(*peerAddr);
-                readCallback_(peer, &buf);
-            } else {
-                const struct sockaddr_in* peerAddr =
-                    reinterpret_cast<const struct sockaddr_in*>(&peerAddrStorage);
-                InetAddress peer(*peerAddr);
-                readCallback_(peer, &buf);
-            }
+        if (packetCallback_ || readCallback_ || stunResponder_) {
+            deliver(buf.data(), n, segmentSize, InetAddress(peerAddrStorage));
         }
     } else {
         RTCLOG(RTC_ERROR, "UdpSocket::handleRead() error: %s", strerror(errno));
     }
 }
 
+// Hands one received buffer to the read callback, split into its GRO segments.
+void UdpSocket::deliver(const char* data, size_t len, size_t segmentSize, const InetAddress& peer) {
+    if (segmentSize == 0 || segmentSize >= len) {
+        segmentSize = len;
+    }
+    size_t offset = 0;
+    do {
+        const size_t chunk = std::min(segmentSize, len - offset);
+        if (stunResponder_ && stunResponder_->handle(this, peer, data + offset, chunk)) {
+            // answered in place
+        } else if (packetCallback_) {
+            packetCallback_(peer, data + offset, chunk);
+        } else if (readCallback_) {
+            Buffer buf;
+            buf.append(data + offset, chunk);
+            readCallback_(peer, &buf);
+        }
+        offset += chunk;
+    } while (offset < len);
+}
+
+void UdpSocket::handleBatchRead() {
+    size_t delivered = 0;
+    while (delivered < readBudget_) {
+        for (size_t i = 0; i < batchSize_; ++i) {
+            struct msghdr& hdr = batchMsgs_[i].msg_hdr;
+            hdr.msg_namelen = sizeof(struct sockaddr_storage);
+            const bool control = groEnabled_ || timestamping_;
+            hdr.msg_control = control ? &batchControl_[i * kControlSpace] : NULL;
+            hdr.msg_controllen = control ? kControlSpace : 0;
+        }
+        int n = ::recvmmsg(sockfd_, batchMsgs_.data(), static_cast<unsigned int>(batchSize_), MSG_DONTWAIT, NULL);
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                RTCLOG(RTC_ERROR, "UdpSocket::handleBatchRead() error: %s", strerror(errno));
+            }
+            break;
+        }
+        size_t count = 0;
+        for (int i = 0; i < n; ++i) {
+            const struct msghdr& hdr = batchMsgs_[i].msg_hdr;
+            const char* data = &batchBuf_[i * maxPacketSize_];
+            const size_t len = batchMsgs_[i].msg_len;
+            InetAddress peer(batchAddrs_[i]);
+            if (hdr.msg_flags & MSG_TRUNC) {
+                RTCLOG(RTC_WARN, "UdpSocket::handleBatchRead() %s truncated datagram from %s",
+                       name_.c_str(), peer.toIpPort().c_str());
+            }
+            const int64_t timestampNs = timestamping_ ? sockets::rxTimestampNs(hdr) : 0;
+            size_t segmentSize = groEnabled_ ? groSegmentSize(hdr) : 0;
+            if (segmentSize == 0 || segmentSize >= len) {
+                segmentSize = len;
+            }
+            size_t offset = 0;
+            do {
+                const size_t chunk = std::min(segmentSize, len - offset);
+                if (stunResponder_ && stunResponder_->handle(this, peer, data + offset, chunk)) {
+                    offset += chunk;
+                    continue;
+                }
+                if (count == batchPackets_.size()) {
+                    batchPackets_.resize(count * 2, UdpPacket{ nullptr, 0, InetAddress(), 0 });
+                }
+                UdpPacket& packet = batchPackets_[count++];
+                packet.data = data + offset;
+                packet.len = chunk;
+                packet.peer = peer;
+                packet.timestampNs = timestampNs;
+                offset += packet.len;
+            } while (offset < len);
+        }
+        if (count == 0) {
+            // all answered by the STUN responder
+        } else if (batchReadCallback_) {
+            batchReadCallback_(batchPackets_.data(), count);
+        } else if (packetCallback_) {
+            for (size_t i = 0; i < count; ++i) {
+                receiveTimestampNs_ = batchPackets_[i].timestampNs;
+                packetCallback_(batchPackets_[i].peer, batchPackets_[i].data, batchPackets_[i].len);
+            }
+        } else if (readCallback_) {
+            for (size_t i = 0; i < count; ++i) {
+                receiveTimestampNs_ = batchPackets_[i].timestampNs;
+                Buffer buf;
+                buf.append(batchPackets_[i].data, batchPackets_[i].len);
+                readCallback_(batchPackets_[i].peer, &buf);
+            }
+        }
+        delivered += n;
+        if (static_cast<size_t>(n) < batchSize_) {
+            break; // drained
+        }
+    }
+}
+
 } // namespace hvnetpp